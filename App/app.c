@@ -8,12 +8,46 @@
 #include "usbd_def.h"
 #include "usbd_cdc_if.h"
 #include "proto.h"
+#include "busload.h"
+#include "can_filter.h"
+#include "data_filter.h"
+#include "id_accept.h"
+#include "rx_policy.h"
+#include "rx_pack.h"
+#include "rx_congest.h"
+#include "rx_span.h"
+#include "snapshot.h"
+#include "id_stats.h"
+#include "signals.h"
+#include "tx_sched.h"
+#include "tt_sched.h"
+#include "responder.h"
+#include "rule_vm.h"
+#include "e2e.h"
+#include "isotp.h"
+#include "latency.h"
+#include "timebase.h"
 #include "used_libs.h"
 
 #define USB_RX_BUF_SIZE	256
-#define USB_TX_BUF_SIZE	2048
+#define USB_TX_BUF_SIZE	1024
+#define USB_HP_BUF_SIZE	256
+#define USB_LAT_SAMPLES	64		//frames per USB transfer sampled for latency
+#define USB_RX_SPAN		(USB_TX_BUF_SIZE/sizeof(CAN_USB_MessPck_t))	//frames per transfer straight from can_rx_buf
 
 #define LED_DURATION	1
+#define CAN_INIT_TIMEOUT	10	//ms, same as HAL
+#define CAN_ERR_BUF_SIZE	16
+#define CAN_HP_BUF_SIZE		32
+#define RX_POLL_BURST		8		//FIFO0 frames per main loop pass that switch to polling
+#define RX_POLL_IDLE		32		//empty polls in a row that give the interrupt back
+#define RX_POLL_BUDGET		3		//FIFO0 frames per poll, the FIFO depth
+
+#define CAN_RX_IT			(CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO0_OVERRUN | CAN_IT_RX_FIFO1_MSG_PENDING | CAN_IT_RX_FIFO1_OVERRUN)
+#define CAN_ERROR_IT		(CAN_IT_ERROR_WARNING | CAN_IT_ERROR_PASSIVE | CAN_IT_BUSOFF | CAN_IT_LAST_ERROR_CODE | CAN_IT_ERROR)
+#define CAN_FATAL_ERRORS	(HAL_CAN_ERROR_TIMEOUT | HAL_CAN_ERROR_NOT_INITIALIZED)
+
+extern USBD_HandleTypeDef hUsbDeviceFS;
 
 uint32_t tx_off_time = 0;
 uint32_t rx_off_time = 0;
@@ -22,90 +56,218 @@ static uint8_t usb_rx_buf[USB_RX_BUF_SIZE];
 static uint8_t usb_tx_buf[USB_TX_BUF_SIZE];
 static uint16_t usb_rx_head = 0;
 static uint16_t	usb_rx_tail = 0;
+static uint32_t	usb_rx_since = 0;	//tb_us() when the ring last went non-empty
 static uint16_t usb_tx_idx = 0;
+static uint32_t usb_tx_times[USB_LAT_SAMPLES];
+static uint8_t	usb_tx_samples = 0;
+
+//high priority lane: own buffer, sent ahead of usb_tx_buf
+static uint8_t	usb_hp_buf[USB_HP_BUF_SIZE];
+static uint16_t usb_hp_idx = 0;
+static uint8_t	usb_hp_busy = 0;
+static uint32_t usb_hp_times[USB_HP_BUF_SIZE/(sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_Mess_t))];
+static uint8_t	usb_hp_samples = 0;
+static Latency_t lat_bulk;
+static Latency_t lat_prio;
+static Latency_t lat_tx;		//USB packet to the end of the frame on the bus
+
+static CAN_USB_Mess_t	can_tx_buf[CAN_TX_BUF_SIZE];
+static uint32_t			can_tx_time[CAN_TX_BUF_SIZE];	//tb_us() at USB reception
+static volatile uint16_t	can_tx_head = 0;
+static uint16_t			can_tx_tail = 0;
+static uint32_t			can_tx_direct = 0;
+static uint8_t			tx_direct_on = 1;
 
-static CAN_USB_Mess_t	can_tx_buf[CAN_BUF_SIZE];
-static uint16_t			can_tx_idx = 0;
+static CAN_USB_MessPck_t	can_rx_buf[CAN_BUF_SIZE];	//wire format, headers are set once
+static uint32_t			can_rx_time[CAN_BUF_SIZE];	//tb_us() at reception
+static Rx_Span_t		can_rx;
+static uint32_t			can_rx_overruns = 0;
+static uint32_t			can_sw_rejected = 0;
 
-static CAN_USB_Mess_t	can_rx_buf[CAN_BUF_SIZE];
-static uint16_t			can_rx_idx = 0;
+static CAN_USB_Mess_t	can_hp_buf[CAN_HP_BUF_SIZE];
+static uint32_t			can_hp_time[CAN_HP_BUF_SIZE];
+static volatile uint16_t	can_hp_head = 0;
+static uint16_t			can_hp_tail = 0;
+static uint32_t			can_hp_frames = 0;
+static uint32_t			can_hp_overruns = 0;
+
+static uint8_t			can_rx_polling = 0;
+static volatile uint8_t	can_rx_burst = 0;
+static uint8_t			can_rx_idle = 0;
+static uint32_t			can_rx_poll_entries = 0;
+static uint32_t			can_rx_poll_start = 0;	//tb_us()
+static uint32_t			can_rx_poll_us = 0;
+static volatile uint32_t	can_rx_cycles = 0;		//RX0 interrupt and polling
+static uint32_t			rx_stat_start = 0;
 
 static uint8_t can_started = 0;
+static uint8_t can_opmode = CAN_OPMODE_NORMAL;
+static uint16_t can_reconf_us = 0;
+static uint16_t can_reconf_max_us = 0;
+
+static CAN_USB_Error_t	can_err_buf[CAN_ERR_BUF_SIZE];
+static volatile uint16_t	can_err_head = 0;
+static uint16_t			can_err_tail = 0;
+static uint8_t			can_estate = CAN_ESTATE_ACTIVE;
+static uint16_t			can_busoff_count = 0;
+static uint32_t			can_error_frames = 0;
+static uint32_t			can_fifo_overruns = 0;
+
+static uint16_t			can_tx_bits[3];		//on-wire length per mailbox, counted when sent
+static uint32_t			can_tx_start[3];	//USB reception time per mailbox
+static uint8_t			can_tx_timed = 0;	//mailboxes with a valid can_tx_start
+static uint8_t			can_tx_tag[3];		//app_can_send() tag per mailbox
+static uint8_t			can_tx_last = 0;	//mailbox taken by the last can_tx_submit()
+static uint32_t			status_period = 0;
+static uint32_t			status_time = 0;
 static uint8_t*	core_uid = (uint8_t*)UID_BASE;
 
 
 static const uint16_t prescaler[CAN_BAUD_END] = {0, 400, 200, 160, 80, 40, 32, 20, 16, 10, 8, 5, 4};
+static const uint32_t opmode[CAN_OPMODE_END] = {CAN_MODE_NORMAL, CAN_MODE_SILENT, CAN_MODE_LOOPBACK, CAN_MODE_SILENT_LOOPBACK};
 
 //
 //Private forwards
 //
-void start_can(uint8_t baud);
-void send_via_can(CAN_USB_Mess_t* mess);
+void start_can(uint8_t baud, uint8_t mode);
+HAL_StatusTypeDef reconfigure_can();
+void send_via_can(const CAN_USB_Mess_t* mess, uint32_t time);
+uint16_t usb_rx_direct(const uint8_t* buf, uint16_t len, uint32_t now);
+uint8_t can_tx_free();
+uint8_t rule_vm_emit(const CAN_USB_Mess_t* mess);
+uint8_t can_tx_submit(const CAN_USB_Mess_t* mess, uint32_t time, uint8_t timed);
+void can_tx_complete();
+void can_tx_tagged(uint8_t done, uint8_t ok);
 uint8_t send_via_usb(uint8_t* data, uint16_t len);
+uint8_t usb_tx_busy();
+void note_bulk(uint32_t rx_time);
 void handle_usb_tx();
+void handle_can_hp();
+void handle_can_poll();
+void rx_poll_stop();
+void can_rx_fifo0();
 void handle_usb_rx();
 void handle_can_tx();
 void parse_usb(CAN_USB_Header_t* hdr, uint8_t* payload);
 void handle_command(CAN_USB_Header_t* hdr, uint8_t* payload);
 void handle_request(CAN_USB_Header_t* hdr, uint8_t* payload);
 void handle_can_rx();
+void handle_can_errors();
+uint8_t can_estate_of(uint32_t esr);
+void can_err_note(uint32_t code, uint8_t lec, uint32_t esr);
+void handle_status();
+void handle_isotp();
+void send_snapshot(const CAN_USB_SnapshotReq_t* req);
+void send_id_stats(uint16_t cursor);
+void fill_status(CAN_USB_Status_t* st);
+uint32_t can_bitrate();
+uint8_t set_option(uint8_t option, uint32_t value);
+uint32_t get_option(uint8_t option);
+void tt_mode(uint8_t on);
 void tx_led_on();
 void rx_led_on();
 void handle_leds();
+void fill_mess(CAN_USB_Mess_t* mess, const CAN_RxHeaderTypeDef* hdr);
 //
 //Public members
 //
 void app_init()
 {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	busload_init();
+	id_accept_clear();
+	data_filter_clear();
+	rx_policy_init();
+	latency_reset(&lat_bulk);
+	latency_reset(&lat_prio);
+	latency_reset(&lat_tx);
+	rx_pack_init();
+	for (uint16_t i = 0; i < CAN_BUF_SIZE; i++)
+	{
+		can_rx_buf[i].hdr.prefix = _PREFIX_;
+		can_rx_buf[i].hdr.type = CAN_PT_MESS;
+		can_rx_buf[i].hdr.datalen = sizeof(CAN_USB_Mess_t);
+	}
+	rx_span_init(&can_rx, CAN_BUF_SIZE);
+	rx_congest_init(can_rx_buf, CAN_BUF_SIZE);
+	snapshot_init();
+	id_stats_init();
+	signals_init();
+	tx_sched_init();
+	tt_init();
+	responder_clear();
+	rule_vm_init(rule_vm_emit);
+	e2e_init();
+	isotp_init();
+
+	//start_can() applies it, TTCM and ABOM follow CAN_PT_TT and CAN_OPT_BUSOFF
+	hcan1.Init.TransmitFifoPriority = tx_direct_on?ENABLE:DISABLE;
 	HAL_CAN_Start(&hcan1);
 }
 
 FAST_RUN void app_step()
 {
+	handle_can_hp();
+	handle_can_poll();
 	handle_usb_rx();
 	handle_usb_tx();
 	handle_can_tx();
+	handle_can_poll();
 	handle_can_rx();
+	handle_can_errors();
+	handle_status();
+	handle_isotp();
 	handle_leds();
-
-	if (hcan1.ErrorCode)
-	{
-		HAL_CAN_DeInit(&hcan1);
-		HAL_CAN_Init(&hcan1);
-		HAL_CAN_Start(&hcan1);
-	}
 }
 
+//
+//Runs from CDC_Receive_FS(). While nothing waits in the ring, leading
+//CAN_PT_MESS packets skip it and handle_usb_rx(), the rest is queued as usual.
+//
 FAST_RUN void usb_rx(uint8_t* Buf, uint32_t *Len)
 {
-	uint16_t len1 = *Len;
+	uint32_t now = tb_us();
+	uint16_t used = 0;
+
+	if (usb_rx_head == usb_rx_tail)
+	{
+		used = usb_rx_direct(Buf, *Len, now);
+		usb_rx_since = now;
+	}
+
+	uint16_t len = *Len - used;
+	uint16_t len1 = len;
 	uint16_t len2 = 0;
 
-	if (len1 >= USB_RX_BUF_SIZE)
+	if (!len || (len >= USB_RX_BUF_SIZE))
 		return;
 
 	if ((len1 + usb_rx_head) >= USB_RX_BUF_SIZE)
 	{
 		len1 = USB_RX_BUF_SIZE - usb_rx_head;
-		len2 = *Len - len1;
+		len2 = len - len1;
 	}
 
 	if (len1)
-		memcpy(&usb_rx_buf[usb_rx_head], Buf, len1);
+		memcpy(&usb_rx_buf[usb_rx_head], &Buf[used], len1);
 
 	if (len2)
-		memcpy(usb_rx_buf, &Buf[len1], len2);
+		memcpy(usb_rx_buf, &Buf[used + len1], len2);
 
-	usb_rx_head = ring_add(usb_rx_head, *Len, sizeof(usb_rx_buf));
+	usb_rx_head = ring_add(usb_rx_head, len, sizeof(usb_rx_buf));
 }
 
 //
 //Private members
 //
 
-FAST_RUN void start_can(uint8_t baud)
+void start_can(uint8_t baud, uint8_t mode)
 {
 	if (baud >= CAN_BAUD_END) return;
+	if (mode >= CAN_OPMODE_END) return;
 	if (baud == 0) //stop CAN
 	{
 		if (can_started)
@@ -113,28 +275,139 @@ FAST_RUN void start_can(uint8_t baud)
 			HAL_CAN_Stop(&hcan1);
 			can_started = 0;
 			HAL_GPIO_WritePin(USB_LED, GPIO_PIN_RESET);
-			HAL_CAN_DeactivateNotification(&hcan1, CAN_IT_RX_FIFO0_MSG_PENDING);
+			HAL_CAN_DeactivateNotification(&hcan1, CAN_RX_IT | CAN_ERROR_IT);
+			rx_poll_stop();
 		}
 	}
 	else
 	{
-		if (can_started) HAL_CAN_Stop(&hcan1);
-
-		HAL_CAN_DeInit(&hcan1);
 		hcan1.Init.Prescaler = prescaler[baud];
-		HAL_CAN_Init(&hcan1);
-		HAL_CAN_Start(&hcan1);
+		hcan1.Init.Mode = opmode[mode];
+		if (reconfigure_can() != HAL_OK)
+		{
+			//peripheral is stuck, fall back to the full HAL path
+			HAL_CAN_DeInit(&hcan1);
+			HAL_CAN_Init(&hcan1);
+			HAL_CAN_Start(&hcan1);
+		}
 		can_started = baud;
+		can_opmode = mode;
 		HAL_GPIO_WritePin(USB_LED, GPIO_PIN_SET);
-		HAL_CAN_ActivateNotification(&hcan1, CAN_IT_RX_FIFO0_MSG_PENDING);
+		rx_poll_stop();
+		HAL_CAN_ActivateNotification(&hcan1, CAN_RX_IT | CAN_ERROR_IT);
 	}
 }
 
-FAST_RUN void send_via_can(CAN_USB_Mess_t* mess)
+//
+//Applies hcan1.Init to a running controller: INRQ, rewrite MCR/BTR, leave INRQ.
+//GPIO, NVIC, filters and pending mailboxes are left alone, so the only
+//blind time is the init mode itself plus the 11 recessive bits resync.
+//
+HAL_StatusTypeDef reconfigure_can()
+{
+	CAN_TypeDef* can = hcan1.Instance;
+
+	if (hcan1.State == HAL_CAN_STATE_RESET)
+		return HAL_ERROR;
+
+	uint32_t tickstart = HAL_GetTick();
+	SET_BIT(can->MCR, CAN_MCR_INRQ);
+	while (!(can->MSR & CAN_MSR_INAK))
+	{
+		if ((HAL_GetTick() - tickstart) > CAN_INIT_TIMEOUT)
+			return HAL_ERROR;
+	}
+	uint32_t blind_start = CYCLES();
+
+	uint32_t mcr = can->MCR & ~(CAN_MCR_TTCM | CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_NART | CAN_MCR_RFLM | CAN_MCR_TXFP);
+	if (hcan1.Init.TimeTriggeredMode == ENABLE) mcr |= CAN_MCR_TTCM;
+	if (hcan1.Init.AutoBusOff == ENABLE) mcr |= CAN_MCR_ABOM;
+	if (hcan1.Init.AutoWakeUp == ENABLE) mcr |= CAN_MCR_AWUM;
+	if (hcan1.Init.AutoRetransmission == DISABLE) mcr |= CAN_MCR_NART;
+	if (hcan1.Init.ReceiveFifoLocked == ENABLE) mcr |= CAN_MCR_RFLM;
+	if (hcan1.Init.TransmitFifoPriority == ENABLE) mcr |= CAN_MCR_TXFP;
+	can->MCR = mcr;
+	can->BTR = hcan1.Init.Mode | hcan1.Init.SyncJumpWidth | hcan1.Init.TimeSeg1 | hcan1.Init.TimeSeg2 | (hcan1.Init.Prescaler - 1U);
+
+	//HAL_CAN_Stop() leaves the controller in init mode, start it the HAL way
+	if (hcan1.State != HAL_CAN_STATE_LISTENING)
+	{
+		hcan1.State = HAL_CAN_STATE_READY;
+		return HAL_CAN_Start(&hcan1);
+	}
+
+	tickstart = HAL_GetTick();
+	CLEAR_BIT(can->MCR, CAN_MCR_INRQ);
+	while (can->MSR & CAN_MSR_INAK)
+	{
+		if ((HAL_GetTick() - tickstart) > CAN_INIT_TIMEOUT)
+			return HAL_ERROR;
+	}
+
+	uint32_t us = CYCLES_TO_US(CYCLES() - blind_start);
+	can_reconf_us = (us > 0xFFFF)?0xFFFF:us;
+	if (can_reconf_us > can_reconf_max_us)
+		can_reconf_max_us = can_reconf_us;
+
+	return HAL_OK;
+}
+
+//
+//Called from the USB callback only while the USB ring is empty and from
+//handle_usb_rx() only while it isn't, so the queue head has one writer at a time.
+//
+FAST_RUN void send_via_can(const CAN_USB_Mess_t* mess, uint32_t time)
 {
 	if (!can_started) return;
-	if (can_tx_idx >= CAN_BUF_SIZE) return;
-	memcpy(&can_tx_buf[can_tx_idx++], mess, sizeof(CAN_USB_Mess_t));
+	if (can_opmode == CAN_OPMODE_SILENT) return; //listen only: never touch the bus
+	if (ring_len(can_tx_head, can_tx_tail, CAN_TX_BUF_SIZE) >= (CAN_TX_BUF_SIZE - 1)) return;
+	memcpy(&can_tx_buf[can_tx_head], mess, sizeof(CAN_USB_Mess_t));
+	can_tx_time[can_tx_head] = time;
+	can_tx_head = ring_add(can_tx_head, 1, CAN_TX_BUF_SIZE);
+}
+
+//
+//Cut-through from the USB callback. A frame only takes a mailbox directly
+//when the queue is empty, so it can't overtake queued frames, and TXFP sends
+//the mailboxes in request order. CAN_OPT_TX_DIRECT turns both off together.
+//
+FAST_RUN uint16_t usb_rx_direct(const uint8_t* buf, uint16_t len, uint32_t now)
+{
+	const uint16_t pck_len = sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_Mess_t);
+	uint16_t used = 0;
+
+	while ((len - used) >= pck_len)
+	{
+		const CAN_USB_Header_t* hdr = (const CAN_USB_Header_t*)&buf[used];
+		if ((hdr->prefix != _PREFIX_) || (hdr->type != CAN_PT_MESS) || (hdr->datalen != sizeof(CAN_USB_Mess_t)))
+			break;
+
+		CAN_USB_Mess_t mess;
+		memcpy(&mess, &buf[used + sizeof(CAN_USB_Header_t)], sizeof(mess));
+		used += pck_len;
+
+		if (tx_direct_on && can_started && (can_opmode != CAN_OPMODE_SILENT) && (can_tx_head == can_tx_tail))
+		{
+			//the scheduler timer outranks the USB interrupt
+			__disable_irq();
+			uint8_t ok = 0;
+			if (can_tx_free())
+			{
+				can_tx_complete();
+				ok = can_tx_submit(&mess, now, 1);
+				if (ok) can_tx_tag[can_tx_last] = 0;
+			}
+			__enable_irq();
+			if (ok)
+			{
+				can_tx_direct++;
+				continue;
+			}
+		}
+		send_via_can(&mess, now);
+	}
+
+	return used;
 }
 
 uint8_t send_via_usb(uint8_t* data, uint16_t len)
@@ -183,60 +456,270 @@ FAST_RUN void handle_usb_rx()
 	free(payload);
 }
 
+FAST_RUN uint8_t usb_tx_busy()
+{
+	USBD_CDC_HandleTypeDef* hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+	return hcdc && (hcdc->TxState != 0);
+}
+
+FAST_RUN void note_bulk(uint32_t rx_time)
+{
+	if (usb_tx_samples < USB_LAT_SAMPLES)
+		usb_tx_times[usb_tx_samples++] = rx_time;
+}
+
+//
+//The high priority lane takes the endpoint whenever it has data, the bulk
+//buffer only goes when the lane is empty.
+//
 FAST_RUN void handle_usb_tx()
 {
+	if (usb_hp_idx)
+	{
+		if (CDC_Transmit_FS(usb_hp_buf, usb_hp_idx) == USBD_OK)
+		{
+			uint32_t now = tb_us();
+			for (uint8_t i = 0; i < usb_hp_samples; i++)
+				latency_add(&lat_prio, now - usb_hp_times[i]);
+			usb_hp_samples = 0;
+			usb_hp_idx = 0;
+			usb_hp_busy = 1;
+		}
+		return;
+	}
+
 	if (!usb_tx_idx) return;
 	if (CDC_Transmit_FS(usb_tx_buf, usb_tx_idx) == USBD_OK)
+	{
+		uint32_t now = tb_us();
+		for (uint8_t i = 0; i < usb_tx_samples; i++)
+			latency_add(&lat_bulk, now - usb_tx_times[i]);
+		usb_tx_samples = 0;
 		usb_tx_idx = 0;
+		usb_hp_busy = 0;	//the endpoint took another transfer, the lane buffer is free
+	}
 
 }
 
+//
+//NAPI style: a burst of FIFO0 interrupts between two main loop passes masks
+//FMP0 and the FIFO is drained here instead, one interrupt entry less per
+//frame. The interrupt comes back after RX_POLL_IDLE empty polls.
+//
+FAST_RUN void handle_can_poll()
+{
+	can_rx_burst = 0;
+	if (!can_rx_polling) return;
+
+	//bounded, so a flooded bus can't keep the other handlers from running
+	uint8_t n = 0;
+	while ((n < RX_POLL_BUDGET) && (hcan1.Instance->RF0R & CAN_RF0R_FMP0))
+	{
+		//same context as the interrupt: the FIFO1 lane shares the RX stages
+		__disable_irq();
+		uint32_t start = CYCLES();
+		can_rx_fifo0();
+		can_rx_cycles += CYCLES() - start;
+		__enable_irq();
+		n++;
+	}
+
+	if (n)
+	{
+		can_rx_idle = 0;
+		return;
+	}
+	if (++can_rx_idle < RX_POLL_IDLE) return;
+
+	rx_poll_stop();
+	__HAL_CAN_ENABLE_IT(&hcan1, CAN_IT_RX_FIFO0_MSG_PENDING);
+}
+
+void rx_poll_stop()
+{
+	if (!can_rx_polling) return;
+	can_rx_polling = 0;
+	can_rx_poll_us += tb_us() - can_rx_poll_start;
+}
+
+//
+//FIFO1 frames skip every software stage and the coalescing of the bulk
+//path: they are packed as soon as the lane buffer isn't on the wire.
+//
+FAST_RUN void handle_can_hp()
+{
+	if (can_hp_tail == can_hp_head) return;
+	if (usb_hp_busy && usb_tx_busy()) return;
+	usb_hp_busy = 0;
+
+	uint16_t head = can_hp_head;
+	while ((can_hp_tail != head) && ((usb_hp_idx + sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_Mess_t)) <= USB_HP_BUF_SIZE))
+	{
+		rx_led_on();
+		usb_hp_idx += make_usb_can_pck(CAN_PT_MESS, &can_hp_buf[can_hp_tail], sizeof(CAN_USB_Mess_t), &usb_hp_buf[usb_hp_idx]);
+		usb_hp_times[usb_hp_samples++] = can_hp_time[can_hp_tail];
+		can_hp_tail = ring_add(can_hp_tail, 1, CAN_HP_BUF_SIZE);
+	}
+
+	handle_usb_tx();
+}
+
 FAST_RUN void handle_can_tx()
 {
 	if (!can_started) return;
 
-	if (can_tx_idx)
+	__disable_irq();
+	can_tx_complete();
+	__enable_irq();
+
+	//the tail moves only after the mailbox is taken: the USB callback sees
+	//a non-empty queue meanwhile and appends instead of cutting through
+	if (can_tx_head != can_tx_tail)
 	{
-		if (HAL_CAN_GetTxMailboxesFreeLevel(&hcan1))
-		{
-			CAN_USB_Mess_t* mess = can_tx_buf;
+		__disable_irq();
+		uint8_t ok = can_tx_free() && can_tx_submit(&can_tx_buf[can_tx_tail], can_tx_time[can_tx_tail], 1);
+		if (ok) can_tx_tag[can_tx_last] = 0;
+		__enable_irq();
+		if (ok)
+			can_tx_tail = ring_add(can_tx_tail, 1, CAN_TX_BUF_SIZE);
+	}
+}
 
-			uint32_t mailbox = 0;
-			CAN_TxHeaderTypeDef hdr;
-			hdr.DLC = mess->flags.dlc;
-			hdr.StdId = hdr.ExtId = 0;
-			hdr.RTR = mess->flags.rtr?CAN_RTR_REMOTE:CAN_RTR_DATA;
-			hdr.IDE = mess->flags.ide?CAN_ID_EXT:CAN_ID_STD;
-			hdr.TransmitGlobalTime = 0;
-			hdr.ExtId = hdr.StdId = mess->id;
+//
+//Scheduled frames run from the TIM2 interrupt and go ahead of the host
+//queue. A stopped or listen-only bus takes the frame and drops it, as for
+//the host. A tag comes back through tt_tx_done() on completion.
+//
+FAST_RUN uint8_t app_can_send(const CAN_USB_Mess_t* mess, uint8_t tag)
+{
+	if (!can_started || (can_opmode == CAN_OPMODE_SILENT)) return 1;
+	if (!HAL_CAN_GetTxMailboxesFreeLevel(&hcan1)) return 0;
 
-			if (HAL_CAN_AddTxMessage(&hcan1, &hdr, mess->data, &mailbox) == HAL_OK)
+	can_tx_complete();
+	if (!can_tx_submit(mess, 0, 0)) return 0;
+	can_tx_tag[can_tx_last] = tag;
+	return 1;
+}
+
+//rule VM sends go out untagged, as responder frames
+FAST_RUN uint8_t rule_vm_emit(const CAN_USB_Mess_t* mess)
+{
+	return app_can_send(mess, 0);
+}
+
+//host frames leave one mailbox to the schedulers and responders while they are busy
+FAST_RUN uint8_t can_tx_free()
+{
+	return HAL_CAN_GetTxMailboxesFreeLevel(&hcan1) > ((tx_sched_active() || tt_active() || responder_active() || rule_vm_active() || isotp_active())?1:0);
+}
+
+//
+//Mailbox submission for every TX path, callers keep each other out.
+//timed: time is a USB reception time for the latency figures.
+//E2E counter and CRC go into a copy, the caller's frame is left as is.
+//
+FAST_RUN uint8_t can_tx_submit(const CAN_USB_Mess_t* mess, uint32_t time, uint8_t timed)
+{
+	uint32_t mailbox = 0;
+	uint8_t data[8];
+	memcpy(data, mess->data, sizeof(data));
+	uint8_t e2e = e2e_tx(mess, data);
+
+	CAN_TxHeaderTypeDef hdr;
+	hdr.DLC = mess->flags.dlc;
+	hdr.StdId = hdr.ExtId = 0;
+	hdr.RTR = mess->flags.rtr?CAN_RTR_REMOTE:CAN_RTR_DATA;
+	hdr.IDE = mess->flags.ide?CAN_ID_EXT:CAN_ID_STD;
+	hdr.TransmitGlobalTime = 0;
+	hdr.ExtId = hdr.StdId = mess->id;
+
+	if (HAL_CAN_AddTxMessage(&hcan1, &hdr, data, &mailbox) != HAL_OK)
+		return 0;
+	e2e_tx_sent(e2e);
+
+	can_tx_bits[mailbox >> 1] = busload_frame_bits(mess->id, mess->flags.ide, mess->flags.rtr, mess->flags.dlc, data);
+	can_tx_start[mailbox >> 1] = time;
+	can_tx_last = mailbox >> 1;
+	if (timed) can_tx_timed |= mailbox;
+	else can_tx_timed &= ~mailbox;
+	tx_led_on();
+	return 1;
+}
+
+//
+//Completed mailboxes: count what really made it to the bus. Must not be
+//interrupted by another TX path, a new request clears RQCP and overwrites
+//the per-mailbox bookkeeping.
+//
+FAST_RUN void can_tx_complete()
+{
+	uint32_t tsr = hcan1.Instance->TSR;
+	if (!(tsr & (CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2))) return;
+
+	uint32_t now = tb_us();
+	uint8_t tagged = 0;
+	uint8_t ok = 0;
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		if (tsr & (CAN_TSR_RQCP0 << (8*i)))
+		{
+			if (tsr & (CAN_TSR_TXOK0 << (8*i)))
 			{
-				tx_led_on();
-				can_tx_idx--;
-				memcpy(can_tx_buf, &can_tx_buf[1], sizeof(can_tx_buf[0])*can_tx_idx);
+				busload_frame(can_tx_bits[i]);
+				if (can_tx_timed & (1 << i))
+					latency_add(&lat_tx, now - can_tx_start[i]);
+				ok |= 1 << i;
 			}
+			if (can_tx_tag[i]) tagged |= 1 << i;
+			hcan1.Instance->TSR = CAN_TSR_RQCP0 << (8*i);
 		}
 	}
+
+	if (tagged) can_tx_tagged(tagged, ok);
 }
 
+//
+//Time-triggered frames with their TTCM SOF stamps. The reference message
+//goes first, the slots of its cycle are measured against it.
+//
+FAST_RUN void can_tx_tagged(uint8_t done, uint8_t ok)
+{
+	for (uint8_t pass = 0; pass < 2; pass++)
+	{
+		for (uint8_t i = 0; i < 3; i++)
+		{
+			if (!(done & (1 << i)) || ((can_tx_tag[i] == TT_TAG_REF) != (pass == 0))) continue;
+			uint16_t time = (hcan1.Instance->sTxMailBox[i].TDTR & CAN_TDT0R_TIME) >> CAN_TDT0R_TIME_Pos;
+			tt_tx_done(can_tx_tag[i], (ok >> i) & 1, time);
+			can_tx_tag[i] = 0;
+		}
+	}
+}
+
+//
+//Frames are the only hot packets, commands and requests run from flash
+//to keep .code_ram small.
+//
 FAST_RUN void parse_usb(CAN_USB_Header_t* hdr, uint8_t* payload)
 {
+	if (hdr->type == CAN_PT_MESS)
+	{
+		if (hdr->datalen) send_via_can((CAN_USB_Mess_t*)payload, usb_rx_since);
+		return;
+	}
+
 	if (hdr->datalen) handle_command(hdr, payload);
 	handle_request(hdr, payload);
 }
 
-FAST_RUN void handle_command(CAN_USB_Header_t* hdr, uint8_t* payload)
+void handle_command(CAN_USB_Header_t* hdr, uint8_t* payload)
 {
 	switch(hdr->type)
 	{
-		case CAN_PT_MESS:
-		{
-			send_via_can((CAN_USB_Mess_t*)payload);
-			break;
-		}
 		case CAN_PT_FILTER:
 		{
+			//shorter payload is a readback request
+			if (hdr->datalen < sizeof(CAN_USB_Filter_t)) break;
 			CAN_FilterTypeDef filter;
 			CAN_USB_Filter_t* pl = (CAN_USB_Filter_t*)payload;
 			filter.FilterActivation = pl->FilterActivation;
@@ -255,13 +738,206 @@ FAST_RUN void handle_command(CAN_USB_Header_t* hdr, uint8_t* payload)
 		}
 		case CAN_PT_BAUD:
 		{
-			start_can(*payload);
+			CAN_USB_Baud_t* pl = (CAN_USB_Baud_t*)payload;
+			start_can(pl->baud, (hdr->datalen >= sizeof(CAN_USB_Baud_t))?pl->mode:CAN_OPMODE_NORMAL);
+			break;
+		}
+		case CAN_PT_OPTION:
+		{
+			CAN_USB_Option_t* pl = (CAN_USB_Option_t*)payload;
+			if (hdr->datalen >= sizeof(CAN_USB_Option_t))
+				set_option(pl->option, pl->value);
+			break;
+		}
+		case CAN_PT_FILTER_LIST:
+		{
+			CAN_USB_FilterListCmd_t* pl = (CAN_USB_FilterListCmd_t*)payload;
+			switch(pl->op)
+			{
+				case CAN_FLIST_CLEAR:
+					can_filter_clear();
+					id_accept_clear();
+					break;
+				case CAN_FLIST_ADD:
+				{
+					uint16_t count = can_filter_add(pl->entries, (hdr->datalen - 1)/sizeof(CAN_USB_FilterEntry_t));
+					for (uint16_t i = 0; i < count; i++)
+						id_accept_add(pl->entries[i].id, pl->entries[i].mask, pl->entries[i].flags & CAN_FENTRY_IDE);
+					break;
+				}
+				case CAN_FLIST_APPLY:
+					//a partial software set would drop wanted IDs: refuse the whole list
+					if (id_accept_rejected()) break;
+					if (can_filter_apply())
+						id_accept_commit();
+					break;
+			}
+			break;
+		}
+		case CAN_PT_RX_POLICY:
+		{
+			CAN_USB_RxPolicyCmd_t* pl = (CAN_USB_RxPolicyCmd_t*)payload;
+			uint16_t count = (hdr->datalen - 1)/sizeof(CAN_USB_RxPolicy_t);
+			switch(pl->op)
+			{
+				case CAN_RXP_CLEAR:
+					rx_policy_clear();
+					break;
+				case CAN_RXP_SET:
+					for (uint16_t i = 0; i < count; i++)
+						rx_policy_set(&pl->entries[i]);
+					break;
+				case CAN_RXP_REMOVE:
+					for (uint16_t i = 0; i < count; i++)
+						rx_policy_remove(&pl->entries[i]);
+					break;
+			}
+			break;
+		}
+		case CAN_PT_CONGESTION:
+		{
+			if (hdr->datalen >= sizeof(CAN_USB_Congestion_t))
+				rx_congest_set((CAN_USB_Congestion_t*)payload);
+			break;
+		}
+		case CAN_PT_PERIODIC:
+		{
+			if ((hdr->datalen >= sizeof(CAN_USB_Periodic_t)) || (payload[0] == CAN_PERIODIC_CLEAR))
+				tx_sched_set((CAN_USB_Periodic_t*)payload);
+			break;
+		}
+		case CAN_PT_TT:
+		{
+			switch(payload[0])
+			{
+				case CAN_TT_STOP:
+					tt_stop();
+					tt_mode(0);
+					break;
+				case CAN_TT_CONFIG:
+					if (hdr->datalen >= sizeof(CAN_USB_TtConfig_t))
+						tt_config((CAN_USB_TtConfig_t*)payload);
+					break;
+				case CAN_TT_SLOT:
+					if (hdr->datalen >= sizeof(CAN_USB_TtSlot_t))
+						tt_slot((CAN_USB_TtSlot_t*)payload);
+					break;
+				case CAN_TT_START:
+					if (can_started && (can_opmode != CAN_OPMODE_SILENT))
+					{
+						tt_mode(1);
+						if (!tt_start(can_bitrate())) tt_mode(0);
+					}
+					break;
+			}
+			break;
+		}
+		case CAN_PT_ISOTP:
+		{
+			switch(payload[0])
+			{
+				case CAN_ISOTP_ABORT:
+					isotp_abort();
+					break;
+				case CAN_ISOTP_CONFIG:
+					if (hdr->datalen >= sizeof(CAN_USB_IsoTpConfig_t))
+						isotp_config((CAN_USB_IsoTpConfig_t*)payload);
+					break;
+				case CAN_ISOTP_DATA:
+					if (hdr->datalen <= sizeof(CAN_USB_IsoTpData_t)) break;
+					isotp_data(((CAN_USB_IsoTpData_t*)payload)->offset, ((CAN_USB_IsoTpData_t*)payload)->data, hdr->datalen - sizeof(CAN_USB_IsoTpData_t));
+					break;
+				case CAN_ISOTP_SEND:
+					if (!can_started || (can_opmode == CAN_OPMODE_SILENT)) break;
+					if (hdr->datalen >= sizeof(CAN_USB_IsoTpSend_t))
+						isotp_send(((CAN_USB_IsoTpSend_t*)payload)->len);
+					break;
+			}
+			break;
+		}
+		case CAN_PT_E2E:
+		{
+			if ((hdr->datalen >= sizeof(CAN_USB_E2e_t)) || (payload[0] == CAN_E2E_CLEAR))
+				e2e_set((CAN_USB_E2e_t*)payload);
+			break;
+		}
+		case CAN_PT_RULE_VM:
+		{
+			switch(payload[0])
+			{
+				case CAN_VM_STOP:
+					rule_vm_stop();
+					break;
+				case CAN_VM_LOAD:
+					if (hdr->datalen <= sizeof(CAN_USB_VmLoad_t)) break;
+					rule_vm_load(((CAN_USB_VmLoad_t*)payload)->offset, ((CAN_USB_VmLoad_t*)payload)->code, hdr->datalen - sizeof(CAN_USB_VmLoad_t));
+					break;
+				case CAN_VM_START:
+					if (hdr->datalen >= sizeof(CAN_USB_VmStart_t))
+						rule_vm_start((CAN_USB_VmStart_t*)payload);
+					break;
+			}
+			break;
+		}
+		case CAN_PT_RESPONDER:
+		{
+			if ((hdr->datalen >= sizeof(CAN_USB_Responder_t)) || (payload[0] == CAN_RESP_CLEAR))
+				responder_set((CAN_USB_Responder_t*)payload);
+			break;
+		}
+		case CAN_PT_TIMED:
+		{
+			CAN_USB_TimedCmd_t* pl = (CAN_USB_TimedCmd_t*)payload;
+			uint16_t count = (hdr->datalen - 1)/sizeof(CAN_USB_Timed_t);
+			switch(pl->op)
+			{
+				case CAN_TIMED_FLUSH:
+					tx_timed_flush();
+					break;
+				case CAN_TIMED_ADD:
+					if (!can_started || (can_opmode == CAN_OPMODE_SILENT)) break;
+					for (uint16_t i = 0; i < count; i++)
+						tx_timed_add(&pl->frames[i]);
+					break;
+			}
+			break;
+		}
+		case CAN_PT_SIGNALS:
+		{
+			CAN_USB_SignalCmd_t* pl = (CAN_USB_SignalCmd_t*)payload;
+			uint16_t count = (hdr->datalen - 1)/sizeof(CAN_USB_Signal_t);
+			switch(pl->op)
+			{
+				case CAN_SIG_CLEAR:
+					signals_clear();
+					break;
+				case CAN_SIG_ADD:
+					for (uint16_t i = 0; i < count; i++)
+						signals_add(&pl->signals[i]);
+					break;
+			}
+			break;
+		}
+		case CAN_PT_DATA_FILTER:
+		{
+			CAN_USB_DataFilterCmd_t* pl = (CAN_USB_DataFilterCmd_t*)payload;
+			uint16_t count = (hdr->datalen - 1)/sizeof(CAN_USB_DataRule_t);
+			switch(pl->op)
+			{
+				case CAN_DFILT_CLEAR:
+					data_filter_clear();
+					break;
+				case CAN_DFILT_ADD:
+					for (uint16_t i = 0; i < count; i++)
+						data_filter_add(&pl->rules[i]);
+					break;
+			}
 			break;
 		}
 	}
 }
 
-FAST_RUN void handle_request(CAN_USB_Header_t* hdr, uint8_t* payload)
+void handle_request(CAN_USB_Header_t* hdr, uint8_t* payload)
 {
 	uint8_t tx_buf[256];
 	uint8_t len = 0;
@@ -271,18 +947,12 @@ FAST_RUN void handle_request(CAN_USB_Header_t* hdr, uint8_t* payload)
 		case CAN_PT_FILTER:
 		{
 			CAN_USB_Filter_t fm;
-//			CAN_FilterTypeDef filter;
-//			fm.FilterActivation = filter.FilterActivation;
-//			fm.FilterBank = filter.FilterBank;
-//			fm.FilterFIFOAssignment = filter.FilterFIFOAssignment;
-//			fm.FilterIdHigh = filter.FilterIdHigh;
-//			fm.FilterIdLow = filter.FilterIdLow;
-//			fm.FilterMaskIdHigh = filter.FilterMaskIdHigh;
-//			fm.FilterMaskIdLow = filter.FilterMaskIdLow;
-//			fm.FilterMode = filter.FilterMode;
-//			fm.FilterScale = filter.FilterScale;
-//			fm.SlaveStartFilterBank = filter.SlaveStartFilterBank;
-			memset(&fm, 0, sizeof(fm));
+			uint8_t bank = 0;
+			if (hdr->datalen >= sizeof(CAN_USB_Filter_t))
+				bank = ((CAN_USB_Filter_t*)payload)->FilterBank;
+			else if (hdr->datalen)
+				bank = payload[0];
+			can_filter_read(bank, &fm);
 
 			len = make_usb_can_pck(CAN_PT_FILTER, &fm, sizeof(fm), tx_buf);
 
@@ -290,7 +960,10 @@ FAST_RUN void handle_request(CAN_USB_Header_t* hdr, uint8_t* payload)
 		}
 		case CAN_PT_BAUD:
 		{
-			len = make_usb_can_pck(CAN_PT_BAUD, &can_started, sizeof(can_started), tx_buf);
+			CAN_USB_Baud_t baud;
+			baud.baud = can_started;
+			baud.mode = can_opmode;
+			len = make_usb_can_pck(CAN_PT_BAUD, &baud, sizeof(baud), tx_buf);
 			break;
 		}
 		case CAN_PT_UID:
@@ -298,6 +971,127 @@ FAST_RUN void handle_request(CAN_USB_Header_t* hdr, uint8_t* payload)
 			len = make_usb_can_pck(CAN_PT_UID, core_uid, 12, tx_buf);
 			break;
 		}
+		case CAN_PT_STATUS:
+		{
+			CAN_USB_Status_t st;
+			fill_status(&st);
+			len = make_usb_can_pck(CAN_PT_STATUS, &st, sizeof(st), tx_buf);
+			break;
+		}
+		case CAN_PT_RX_POLICY:
+		{
+			CAN_USB_RxPolicyStat_t ps;
+			rx_policy_stat(&ps);
+			len = make_usb_can_pck(CAN_PT_RX_POLICY, &ps, sizeof(ps), tx_buf);
+			break;
+		}
+		case CAN_PT_SNAPSHOT:
+		{
+			CAN_USB_SnapshotReq_t req;
+			memset(&req, 0, sizeof(req));
+			if (hdr->datalen)
+				memcpy(&req, payload, (hdr->datalen < sizeof(req))?hdr->datalen:sizeof(req));
+			send_snapshot(&req);
+			break;
+		}
+		case CAN_PT_ID_STATS:
+		{
+			uint16_t cursor = 0;
+			if (hdr->datalen >= sizeof(cursor))
+				memcpy(&cursor, payload, sizeof(cursor));
+			send_id_stats(cursor);
+			break;
+		}
+		case CAN_PT_CONGESTION:
+		{
+			CAN_USB_CongestionStat_t cs;
+			rx_congest_stat(&cs);
+			len = make_usb_can_pck(CAN_PT_CONGESTION, &cs, sizeof(cs), tx_buf);
+			break;
+		}
+		case CAN_PT_SIGNALS:
+		{
+			CAN_USB_SignalStat_t ss;
+			signals_stat(&ss);
+			len = make_usb_can_pck(CAN_PT_SIGNALS, &ss, sizeof(ss), tx_buf);
+			break;
+		}
+		case CAN_PT_PERIODIC:
+		{
+			CAN_USB_PeriodicStat_t ps;
+			tx_sched_stat(&ps);
+			len = make_usb_can_pck(CAN_PT_PERIODIC, &ps, sizeof(ps), tx_buf);
+			break;
+		}
+		case CAN_PT_TT:
+		{
+			CAN_USB_TtStat_t ts;
+			tt_stat(&ts);
+			len = make_usb_can_pck(CAN_PT_TT, &ts, sizeof(ts), tx_buf);
+			break;
+		}
+		case CAN_PT_ISOTP:
+		{
+			CAN_USB_IsoTpStat_t is;
+			isotp_stat(&is);
+			len = make_usb_can_pck(CAN_PT_ISOTP, &is, sizeof(is), tx_buf);
+			break;
+		}
+		case CAN_PT_E2E:
+		{
+			CAN_USB_E2eStat_t es;
+			e2e_stat(&es);
+			len = make_usb_can_pck(CAN_PT_E2E, &es, sizeof(es), tx_buf);
+			break;
+		}
+		case CAN_PT_RULE_VM:
+		{
+			CAN_USB_VmStat_t vs;
+			rule_vm_stat(&vs);
+			len = make_usb_can_pck(CAN_PT_RULE_VM, &vs, sizeof(vs), tx_buf);
+			break;
+		}
+		case CAN_PT_RESPONDER:
+		{
+			CAN_USB_ResponderStat_t rs;
+			responder_stat(&rs);
+			len = make_usb_can_pck(CAN_PT_RESPONDER, &rs, sizeof(rs), tx_buf);
+			break;
+		}
+		case CAN_PT_TIMED:
+		{
+			//every add is answered: the host streams against the free count
+			CAN_USB_TimedStat_t ts;
+			tx_timed_stat(&ts);
+			len = make_usb_can_pck(CAN_PT_TIMED, &ts, sizeof(ts), tx_buf);
+			break;
+		}
+		case CAN_PT_DATA_FILTER:
+		{
+			CAN_USB_DataFilterStat_t ds;
+			data_filter_stat(&ds);
+			len = make_usb_can_pck(CAN_PT_DATA_FILTER, &ds, sizeof(ds), tx_buf);
+			break;
+		}
+		case CAN_PT_FILTER_LIST:
+		{
+			CAN_USB_FilterList_t fl;
+			can_filter_report(&fl);
+			fl.sw_rejected = id_accept_rejected();
+			if (fl.sw_rejected) fl.result = 0;
+			len = make_usb_can_pck(CAN_PT_FILTER_LIST, &fl, sizeof(fl), tx_buf);
+			break;
+		}
+		case CAN_PT_OPTION:
+		{
+			if (!hdr->datalen) break;
+			CAN_USB_Option_t opt;
+			opt.option = payload[0];
+			if (opt.option >= CAN_OPT_END) break;
+			opt.value = get_option(opt.option);
+			len = make_usb_can_pck(CAN_PT_OPTION, &opt, sizeof(opt), tx_buf);
+			break;
+		}
 	}
 
 	if(len)
@@ -306,23 +1100,70 @@ FAST_RUN void handle_request(CAN_USB_Header_t* hdr, uint8_t* payload)
 
 FAST_RUN void handle_can_rx()
 {
-	if (can_rx_idx)
+	//a span handed to USB is released once the transfer is over
+	if (!rx_span_release(&can_rx, usb_tx_busy())) return;
+
+	uint16_t head = can_rx.head;
+	if (signals_enabled())
 	{
-		uint16_t idx = 0;
-		while ((idx < can_rx_idx) && ((usb_tx_idx + sizeof(CAN_USB_Mess_t)) < USB_TX_BUF_SIZE))
+		while ((can_rx.tail != head) && ((usb_tx_idx + sizeof(CAN_USB_Header_t) + SIGNALS_RECORD_MAX) < USB_TX_BUF_SIZE))
 		{
-			rx_led_on();
-			uint16_t len = make_usb_can_pck(CAN_PT_MESS, &can_rx_buf[idx], sizeof(CAN_USB_Mess_t), &usb_tx_buf[usb_tx_idx]);
-			idx++;
-			usb_tx_idx += len;
+			CAN_USB_Header_t* pck = (CAN_USB_Header_t*)&usb_tx_buf[usb_tx_idx];
+			uint8_t* out = &usb_tx_buf[usb_tx_idx + sizeof(CAN_USB_Header_t)];
+			uint8_t len = 0;
+			while ((can_rx.tail != head) && ((len + SIGNALS_RECORD_MAX) <= 0xFF) && ((usb_tx_idx + sizeof(CAN_USB_Header_t) + len + SIGNALS_RECORD_MAX) < USB_TX_BUF_SIZE))
+			{
+				rx_led_on();
+				uint16_t slot = rx_span_take(&can_rx);
+				len += signals_extract(&can_rx_buf[slot].mess, can_rx_time[slot], &out[len]);
+				note_bulk(can_rx_time[slot]);
+			}
+			if (!len) continue;
+			pck->prefix = _PREFIX_;
+			pck->type = CAN_PT_SIGNAL_DATA;
+			pck->datalen = len;
+			usb_tx_idx += sizeof(CAN_USB_Header_t) + len;
 		}
+		return;
+	}
 
-		if (idx != can_rx_idx)
+	if (rx_pack_get())
+	{
+		//records are batched, one header per packet
+		while ((can_rx.tail != head) && ((usb_tx_idx + sizeof(CAN_USB_Header_t) + RX_PACK_RECORD_MAX) < USB_TX_BUF_SIZE))
 		{
-			memcpy(can_rx_buf, &can_rx_buf[idx], can_rx_idx - idx);
+			CAN_USB_Header_t* pck = (CAN_USB_Header_t*)&usb_tx_buf[usb_tx_idx];
+			uint8_t* out = &usb_tx_buf[usb_tx_idx + sizeof(CAN_USB_Header_t)];
+			uint8_t len = 0;
+			while ((can_rx.tail != head) && ((len + RX_PACK_RECORD_MAX) <= 0xFF) && ((usb_tx_idx + sizeof(CAN_USB_Header_t) + len + RX_PACK_RECORD_MAX) < USB_TX_BUF_SIZE))
+			{
+				rx_led_on();
+				uint16_t slot = rx_span_take(&can_rx);
+				len += rx_pack_frame(&can_rx_buf[slot].mess, &out[len]);
+				note_bulk(can_rx_time[slot]);
+			}
+			pck->prefix = _PREFIX_;
+			pck->type = CAN_PT_PACKED;
+			pck->datalen = len;
+			usb_tx_idx += sizeof(CAN_USB_Header_t) + len;
 		}
-		can_rx_idx -= idx;
+		return;
 	}
+
+	//plain frames are already packets: USB reads the contiguous part of the
+	//ring in place, after whatever else is queued for the endpoint
+	if ((can_rx.tail == head) || usb_hp_idx || usb_tx_idx) return;
+
+	uint16_t span = rx_span_avail(&can_rx, head, USB_RX_SPAN);
+	if (CDC_Transmit_FS((uint8_t*)&can_rx_buf[can_rx.tail], span*sizeof(CAN_USB_MessPck_t)) != USBD_OK)
+		return;
+
+	rx_led_on();
+	usb_hp_busy = 0;
+	uint32_t now = tb_us();
+	for (uint16_t i = 0; i < span; i++)
+		latency_add(&lat_bulk, now - can_rx_time[can_rx.tail + i]);
+	rx_span_lend(&can_rx, span);
 //	uint8_t res = 1;
 //	while(HAL_CAN_GetRxFifoFillLevel(&hcan1, CAN_RX_FIFO0) && res)
 //	{
@@ -344,6 +1185,312 @@ FAST_RUN void handle_can_rx()
 //	}
 }
 
+//
+//Errors are graded: bus errors and state changes are only reported (the
+//controller handles them itself), API errors are harmless and dropped, only
+//a controller which stopped responding gets the full HAL restart.
+//
+void handle_can_errors()
+{
+	//the SCE interrupt writes ErrorCode too, and recovery from passive or
+	//bus-off clears the ESR levels without any interrupt: poll them here
+	__disable_irq();
+	uint32_t code = hcan1.ErrorCode;
+	hcan1.ErrorCode = HAL_CAN_ERROR_NONE;
+	uint32_t esr = hcan1.Instance->ESR;
+	if (can_estate_of(esr) != can_estate)
+		can_err_note(0, CAN_LEC_NONE, esr);
+	__enable_irq();
+
+	if (code)
+	{
+		if ((code & CAN_FATAL_ERRORS) || (hcan1.State == HAL_CAN_STATE_ERROR))
+		{
+			HAL_CAN_DeInit(&hcan1);
+			HAL_CAN_Init(&hcan1);
+			HAL_CAN_Start(&hcan1);
+			rx_poll_stop();
+			if (can_started)
+				HAL_CAN_ActivateNotification(&hcan1, CAN_RX_IT | CAN_ERROR_IT);
+		}
+	}
+
+	while ((can_err_tail != can_err_head) && ((usb_tx_idx + sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_Error_t)) < USB_TX_BUF_SIZE))
+	{
+		__disable_irq();
+		CAN_USB_Error_t err = can_err_buf[can_err_tail];
+		can_err_tail = ring_add(can_err_tail, 1, CAN_ERR_BUF_SIZE);
+		__enable_irq();
+
+		usb_tx_idx += make_usb_can_pck(CAN_PT_ERROR, &err, sizeof(err), &usb_tx_buf[usb_tx_idx]);
+	}
+}
+
+void handle_status()
+{
+	uint32_t tick = HAL_GetTick();
+	busload_step(tick, can_bitrate());
+
+	//timed queue at half: ask the host for more
+	if (((usb_tx_idx + sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_TimedStat_t)) < USB_TX_BUF_SIZE) && tx_timed_low())
+	{
+		CAN_USB_TimedStat_t ts;
+		tx_timed_stat(&ts);
+		usb_tx_idx += make_usb_can_pck(CAN_PT_TIMED, &ts, sizeof(ts), &usb_tx_buf[usb_tx_idx]);
+	}
+
+	if (!status_period || ((tick - status_time) < status_period)) return;
+	if ((usb_tx_idx + sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_Status_t)) >= USB_TX_BUF_SIZE) return;
+
+	status_time = tick;
+	CAN_USB_Status_t st;
+	fill_status(&st);
+	usb_tx_idx += make_usb_can_pck(CAN_PT_STATUS, &st, sizeof(st), &usb_tx_buf[usb_tx_idx]);
+}
+
+//
+//Transfer results and received PDUs go to the host unsolicited, a PDU in
+//as many pieces as the TX buffer takes; the receiver refuses the next one
+//with FC OVFLW until this one is out.
+//
+void handle_isotp()
+{
+	isotp_step(HAL_GetTick());
+
+	if (((usb_tx_idx + sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_IsoTpStat_t)) < USB_TX_BUF_SIZE) && isotp_changed())
+	{
+		CAN_USB_IsoTpStat_t is;
+		isotp_stat(&is);
+		usb_tx_idx += make_usb_can_pck(CAN_PT_ISOTP, &is, sizeof(is), &usb_tx_buf[usb_tx_idx]);
+	}
+
+	uint8_t pl[0xFF];
+	uint16_t room = USB_TX_BUF_SIZE - usb_tx_idx;
+	while (room > (sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_IsoTpRx_t)))
+	{
+		room -= sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_IsoTpRx_t);
+		if (room > (sizeof(pl) - sizeof(CAN_USB_IsoTpRx_t))) room = sizeof(pl) - sizeof(CAN_USB_IsoTpRx_t);
+
+		uint8_t n = isotp_read((CAN_USB_IsoTpRx_t*)pl, room);
+		if (!n) break;
+		usb_tx_idx += make_usb_can_pck(CAN_PT_ISOTP, pl, sizeof(CAN_USB_IsoTpRx_t) + n, &usb_tx_buf[usb_tx_idx]);
+		room = USB_TX_BUF_SIZE - usb_tx_idx;
+	}
+}
+
+//
+//Batches go out while a full one still fits, the last one tells the host
+//where to continue if the buffer ran out first.
+//
+void send_snapshot(const CAN_USB_SnapshotReq_t* req)
+{
+	uint8_t pl[0xFF];
+	CAN_USB_Snapshot_t* snap = (CAN_USB_Snapshot_t*)pl;
+	uint16_t cursor = req->cursor;
+
+	while ((usb_tx_idx + sizeof(CAN_USB_Header_t) + sizeof(pl)) < USB_TX_BUF_SIZE)
+	{
+		cursor = snapshot_read(req->since, cursor, snap, SNAPSHOT_BATCH);
+		usb_tx_idx += make_usb_can_pck(CAN_PT_SNAPSHOT, snap, sizeof(CAN_USB_Snapshot_t) + snap->count*sizeof(CAN_USB_SnapEntry_t), &usb_tx_buf[usb_tx_idx]);
+		if (!cursor) break;
+	}
+}
+
+void send_id_stats(uint16_t cursor)
+{
+	uint8_t pl[0xFF];
+	CAN_USB_IdStats_t* stats = (CAN_USB_IdStats_t*)pl;
+
+	while ((usb_tx_idx + sizeof(CAN_USB_Header_t) + sizeof(pl)) < USB_TX_BUF_SIZE)
+	{
+		cursor = id_stats_read(cursor, stats, ID_STATS_BATCH);
+		usb_tx_idx += make_usb_can_pck(CAN_PT_ID_STATS, stats, sizeof(CAN_USB_IdStats_t) + stats->count*sizeof(CAN_USB_IdStat_t), &usb_tx_buf[usb_tx_idx]);
+		if (!cursor) break;
+	}
+}
+
+void fill_status(CAN_USB_Status_t* st)
+{
+	st->baud = can_started;
+	st->mode = can_opmode;
+	st->reconf_us = can_reconf_us;
+	st->reconf_max_us = can_reconf_max_us;
+	st->rx_overruns = can_rx_overruns;
+	uint32_t esr = hcan1.Instance->ESR;
+	st->tec = (esr & CAN_ESR_TEC) >> CAN_ESR_TEC_Pos;
+	st->rec = (esr & CAN_ESR_REC) >> CAN_ESR_REC_Pos;
+	st->estate = can_estate_of(hcan1.Instance->ESR);
+	st->busoff_count = can_busoff_count;
+	st->error_frames = can_error_frames;
+	st->fifo_overruns = can_fifo_overruns;
+
+	const Busload_t* load = busload_get();
+	st->load_permille = load->load_permille;
+	st->peak_load_permille = load->peak_load_permille;
+	st->frames_per_s = load->frames_per_s;
+	st->peak_frames_per_s = load->peak_frames_per_s;
+	st->errors_per_s = load->errors_per_s;
+	st->sw_rejected = can_sw_rejected;
+	st->pack_saved = rx_pack_saved();
+	st->prio_frames = can_hp_frames;
+	st->prio_overruns = can_hp_overruns;
+
+	//latency since the previous status
+	st->bulk_p99_us = latency_percentile(&lat_bulk, 990);
+	st->prio_p99_us = latency_percentile(&lat_prio, 990);
+	latency_reset(&lat_bulk);
+	latency_reset(&lat_prio);
+
+	st->tx_direct = can_tx_direct;
+	st->tx_p50_us = latency_percentile(&lat_tx, 500);
+	st->tx_p99_us = latency_percentile(&lat_tx, 990);
+	st->tx_max_us = lat_tx.max;
+	st->tt_cycles = tt_cycles();
+	st->tt_misses = tt_misses();
+	st->e2e_errors = e2e_errors();
+	__disable_irq();
+	latency_reset(&lat_tx);
+	__enable_irq();
+
+	//RX mode split since the previous status
+	uint32_t now = tb_us();
+	uint32_t span = now - rx_stat_start;
+	uint32_t poll_us = can_rx_poll_us + (can_rx_polling?(now - can_rx_poll_start):0);
+	uint32_t cpu_us = CYCLES_TO_US(can_rx_cycles);
+	st->rx_poll_permille = span?(((uint64_t)((poll_us < span)?poll_us:span)*1000)/span):0;
+	st->rx_cpu_permille = span?(((uint64_t)((cpu_us < span)?cpu_us:span)*1000)/span):0;
+	st->rx_poll_entries = can_rx_poll_entries;
+	rx_stat_start = now;
+	can_rx_poll_us = 0;
+	can_rx_cycles = 0;
+	if (can_rx_polling) can_rx_poll_start = now;
+}
+
+//time in the whole CAN1_RX0 handler, HAL dispatch included
+FAST_RUN void app_rx_irq_cycles(uint32_t cycles)
+{
+	can_rx_cycles += cycles;
+}
+
+uint32_t can_bitrate()
+{
+	if (!can_started) return 0;
+	uint32_t tq = 1 + ((hcan1.Init.TimeSeg1 >> CAN_BTR_TS1_Pos) + 1) + ((hcan1.Init.TimeSeg2 >> CAN_BTR_TS2_Pos) + 1);
+	return HAL_RCC_GetPCLK1Freq()/(hcan1.Init.Prescaler*tq);
+}
+
+//TTCM stamps the frames of a TT schedule, the rest of the time it stays off
+void tt_mode(uint8_t on)
+{
+	hcan1.Init.TimeTriggeredMode = on?ENABLE:DISABLE;
+	if (can_started) reconfigure_can();
+}
+
+uint8_t set_option(uint8_t option, uint32_t value)
+{
+	switch(option)
+	{
+		case CAN_OPT_BUSOFF:
+		{
+			if (value > CAN_BUSOFF_AUTO) return 0;
+			hcan1.Init.AutoBusOff = (value == CAN_BUSOFF_AUTO)?ENABLE:DISABLE;
+			if (can_started) reconfigure_can();
+			return 1;
+		}
+		case CAN_OPT_LOAD_WINDOW:
+		{
+			if (value > 0xFFFF) return 0;
+			busload_set_window(value);
+			return 1;
+		}
+		case CAN_OPT_STATUS_PERIOD:
+		{
+			status_period = value;
+			return 1;
+		}
+		case CAN_OPT_SW_ACCEPT:
+		{
+			id_accept_enable(value);
+			return 1;
+		}
+		//packed stream, snapshot and signals are exclusive output modes,
+		//turning one on turns the others off
+		case CAN_OPT_PACK:
+		{
+			if (value > 0xFF) return 0;
+			if (value)
+			{
+				snapshot_set_mode(CAN_SNAP_OFF);
+				signals_enable(0);
+			}
+			return rx_pack_set(value);
+		}
+		case CAN_OPT_SNAPSHOT:
+		{
+			if (value >= CAN_SNAP_END) return 0;
+			if (value != CAN_SNAP_OFF)
+			{
+				rx_pack_set(0);
+				signals_enable(0);
+			}
+			return snapshot_set_mode(value);
+		}
+		case CAN_OPT_ID_STATS:
+		{
+			if (value >= CAN_IDSTAT_END) return 0;
+			id_stats_set_mode(value);
+			return 1;
+		}
+		case CAN_OPT_SIGNALS:
+		{
+			if (value)
+			{
+				rx_pack_set(0);
+				snapshot_set_mode(CAN_SNAP_OFF);
+			}
+			signals_enable(value);
+			return 1;
+		}
+		case CAN_OPT_TX_DIRECT:
+		{
+			if (value > 1) return 0;
+			tx_direct_on = value;
+			hcan1.Init.TransmitFifoPriority = value?ENABLE:DISABLE;
+			if (can_started) reconfigure_can();
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+uint32_t get_option(uint8_t option)
+{
+	switch(option)
+	{
+		case CAN_OPT_BUSOFF:
+			return (hcan1.Init.AutoBusOff == ENABLE)?CAN_BUSOFF_AUTO:CAN_BUSOFF_MANUAL;
+		case CAN_OPT_LOAD_WINDOW:
+			return busload_window();
+		case CAN_OPT_STATUS_PERIOD:
+			return status_period;
+		case CAN_OPT_SW_ACCEPT:
+			return id_accept_enabled();
+		case CAN_OPT_PACK:
+			return rx_pack_get();
+		case CAN_OPT_SNAPSHOT:
+			return snapshot_mode();
+		case CAN_OPT_ID_STATS:
+			return id_stats_mode();
+		case CAN_OPT_SIGNALS:
+			return signals_enabled();
+		case CAN_OPT_TX_DIRECT:
+			return tx_direct_on;
+	}
+
+	return 0;
+}
+
 inline void tx_led_on()
 {
 	HAL_GPIO_WritePin(TX_LED, GPIO_PIN_SET);
@@ -374,19 +1521,201 @@ inline void handle_leds()
 
 //Callback
 FAST_RUN void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan)
+{
+	can_rx_fifo0();
+
+	//a burst: hand the FIFO over to app_step until it runs dry
+	if (++can_rx_burst >= RX_POLL_BURST)
+	{
+		__HAL_CAN_DISABLE_IT(&hcan1, CAN_IT_RX_FIFO0_MSG_PENDING);
+		can_rx_polling = 1;
+		can_rx_idle = 0;
+		can_rx_poll_entries++;
+		can_rx_poll_start = tb_us();
+	}
+}
+
+FAST_RUN void can_rx_fifo0()
 {
 	CAN_RxHeaderTypeDef hdr;
-	CAN_USB_Mess_t* mess = &can_rx_buf[can_rx_idx];
+	CAN_USB_Mess_t scratch;
+	uint16_t head = can_rx.head;
+	uint16_t next = ring_add(head, 1, CAN_BUF_SIZE);
+	//ring full: the frame still has to be released from the FIFO
+	CAN_USB_Mess_t* mess = (next != can_rx.tail)?&can_rx_buf[head].mess:&scratch;
 	memset(mess->data, 0, sizeof(mess->data));
 
 	if (HAL_CAN_GetRxMessage(&hcan1, CAN_RX_FIFO0, &hdr, mess->data) != HAL_OK) return;
+	fill_mess(mess, &hdr);
 
-	mess->id = hdr.IDE?hdr.ExtId:hdr.StdId;
-	mess->flags.ide = (hdr.IDE == CAN_ID_EXT)?1:0;
-	mess->flags.rtr = (hdr.RTR == CAN_RTR_REMOTE)?1:0;
-	mess->flags.dlc = hdr.DLC;
-	mess->filter = hdr.FilterMatchIndex;
+	//the survey sees everything the hardware filters let through
+	uint32_t now = tb_us();
+	tt_rx(mess, hdr.Timestamp, now);
+	e2e_rx(mess);
+	isotp_rx(mess);
+	responder_pass(mess);
+	rule_vm_pass(mess);
+	if (!id_stats_update(mess, now))
+		return;
+
+	if (!id_accept(mess->id, mess->flags.ide))
+	{
+		can_sw_rejected++;
+		return;
+	}
+
+	if (!data_filter_pass(mess))
+		return;
+
+	if (!snapshot_update(mess, now))
+		return;
+
+	if (!signals_pass(mess))
+		return;
+
+	if (!rx_policy_pass(mess, now))
+		return;
+
+	//under backpressure: a newer frame may replace a pending one, even with the ring full
+	uint16_t slot = rx_congest_pass(mess, head, can_rx.tail, can_rx.sent);
+	if (slot == RX_CONGEST_DROP)
+		return;
+	if (slot != RX_CONGEST_KEEP)
+	{
+		can_rx_buf[slot].mess = *mess;
+		can_rx_time[slot] = now;
+		return;
+	}
+
+	if (mess == &scratch)
+	{
+		can_rx_overruns++;
+		return;
+	}
+
+	can_rx_time[head] = now;
+	can_rx.head = next;
+}
+
+//high priority lane: straight to its ring, only counted on the way
+FAST_RUN void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef *hcan)
+{
+	CAN_RxHeaderTypeDef hdr;
+	CAN_USB_Mess_t scratch;
+	uint16_t head = can_hp_head;
+	uint16_t next = ring_add(head, 1, CAN_HP_BUF_SIZE);
+	CAN_USB_Mess_t* mess = (next != can_hp_tail)?&can_hp_buf[head]:&scratch;
+	memset(mess->data, 0, sizeof(mess->data));
+
+	if (HAL_CAN_GetRxMessage(&hcan1, CAN_RX_FIFO1, &hdr, mess->data) != HAL_OK) return;
+	fill_mess(mess, &hdr);
+
+	uint32_t now = tb_us();
+	tt_rx(mess, hdr.Timestamp, now);
+	e2e_rx(mess);
+	isotp_rx(mess);
+	responder_pass(mess);
+	rule_vm_pass(mess);
+	id_stats_update(mess, now);
+	can_hp_frames++;
+
+	if (mess == &scratch)
+	{
+		can_hp_overruns++;
+		return;
+	}
+
+	can_hp_time[head] = now;
+	can_hp_head = next;
+}
+
+FAST_RUN void fill_mess(CAN_USB_Mess_t* mess, const CAN_RxHeaderTypeDef* hdr)
+{
+	mess->id = hdr->IDE?hdr->ExtId:hdr->StdId;
+	mess->flags.ide = (hdr->IDE == CAN_ID_EXT)?1:0;
+	mess->flags.rtr = (hdr->RTR == CAN_RTR_REMOTE)?1:0;
+	mess->flags.dlc = hdr->DLC;
+	//in loopback modes the RX input is cut from the bus: everything received is our own TX
+	mess->flags.echo = (can_opmode >= CAN_OPMODE_LOOPBACK)?1:0;
+	mess->filter = hdr->FilterMatchIndex;
+
+	//own frames are already counted on TX completion
+	if (!mess->flags.echo)
+		busload_frame(busload_frame_bits(mess->id, mess->flags.ide, mess->flags.rtr, mess->flags.dlc, mess->data));
+}
+
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan)
+{
+	uint32_t code = hcan->ErrorCode;
+	hcan->ErrorCode = HAL_CAN_ERROR_NONE;
+
+	uint32_t esr = hcan->Instance->ESR;
+
+	//HAL has already cleared ESR.LEC, recover it from the error code
+	uint8_t lec = CAN_LEC_NONE;
+	if (code & HAL_CAN_ERROR_STF) lec = CAN_LEC_STUFF;
+	else if (code & HAL_CAN_ERROR_FOR) lec = CAN_LEC_FORM;
+	else if (code & HAL_CAN_ERROR_ACK) lec = CAN_LEC_ACK;
+	else if (code & HAL_CAN_ERROR_BR) lec = CAN_LEC_BIT_RECESSIVE;
+	else if (code & HAL_CAN_ERROR_BD) lec = CAN_LEC_BIT_DOMINANT;
+	else if (code & HAL_CAN_ERROR_CRC) lec = CAN_LEC_CRC;
+
+	if (lec != CAN_LEC_NONE)
+	{
+		can_error_frames++;
+		busload_error();
+	}
+	if (code & (HAL_CAN_ERROR_RX_FOV0 | HAL_CAN_ERROR_RX_FOV1)) can_fifo_overruns++;
+	can_err_note(code, lec, esr);
+}
+
+uint8_t can_estate_of(uint32_t esr)
+{
+	if (esr & CAN_ESR_BOFF) return CAN_ESTATE_BUSOFF;
+	if (esr & CAN_ESR_EPVF) return CAN_ESTATE_PASSIVE;
+	if (esr & CAN_ESR_EWGF) return CAN_ESTATE_WARNING;
+	return CAN_ESTATE_ACTIVE;
+}
+
+//
+//Queues a CAN_PT_ERROR report. Runs in the SCE interrupt or with
+//interrupts masked, a state change alone is reported with code 0.
+//
+void can_err_note(uint32_t code, uint8_t lec, uint32_t esr)
+{
+	uint8_t estate = can_estate_of(esr);
+	if ((estate == CAN_ESTATE_BUSOFF) && (can_estate != CAN_ESTATE_BUSOFF)) can_busoff_count++;
+
+	//EWG/EPV/BOF are levels: repeat them only on a transition
+	if (estate == can_estate)
+		code &= ~(HAL_CAN_ERROR_EWG | HAL_CAN_ERROR_EPV | HAL_CAN_ERROR_BOF);
+	uint8_t changed = (estate != can_estate);
+	can_estate = estate;
+
+	if (!code && !changed) return;
+
+	//ring full: merge into the newest pending report
+	uint16_t head = can_err_head;
+	uint16_t next = ring_add(head, 1, CAN_ERR_BUF_SIZE);
+	CAN_USB_Error_t* err;
+	if (next == can_err_tail)
+	{
+		err = &can_err_buf[(head + CAN_ERR_BUF_SIZE - 1) % CAN_ERR_BUF_SIZE];
+		err->code |= code;
+		if (err->count < 0xFFFF) err->count++;
+		if (lec != CAN_LEC_NONE) err->lec = lec;
+	}
+	else
+	{
+		err = &can_err_buf[head];
+		err->code = code;
+		err->count = 1;
+		err->lec = lec;
+	}
+	err->estate = estate;
+	err->tec = (esr & CAN_ESR_TEC) >> CAN_ESR_TEC_Pos;
+	err->rec = (esr & CAN_ESR_REC) >> CAN_ESR_REC_Pos;
 
-	if (can_rx_idx < CAN_BUF_SIZE)
-		can_rx_idx++;
+	if (next != can_err_tail)
+		can_err_head = next;
 }
@@ -8,11 +8,15 @@
 #ifndef APP_H_
 #define APP_H_
 #include "board.h"
+#include "proto.h"
 
-#define CAN_BUF_SIZE			512
+#define CAN_BUF_SIZE			128
+#define CAN_TX_BUF_SIZE			64		//host frames waiting for a mailbox
 
 void app_init();
 void app_step();
 void usb_rx(uint8_t* Buf, uint32_t *Len);
+void app_rx_irq_cycles(uint32_t cycles);
+uint8_t app_can_send(const CAN_USB_Mess_t* mess, uint8_t tag);
 
 #endif /* APP_H_ */
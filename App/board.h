@@ -7,19 +7,36 @@
 
 #ifndef BOARD_H_
 #define BOARD_H_
+
+#ifdef HOST_TEST
+//host unit tests (Tests/): plain functions, nothing to mask
+#include <stdint.h>
+#define FAST_RUN
+#define FLASH_RUN
+#define __disable_irq()
+#define __enable_irq()
+#else
 #include "main.h"
 #include "stm32f1xx_hal.h"
 #include "stm32f1xx_hal_conf.h"
 
 //#define FAST_RUN
 #define FAST_RUN __attribute__ ((long_call, section (".code_ram")))
+//a static helper of a FAST_RUN function, not to be inlined back into RAM
+#define FLASH_RUN __attribute__ ((noinline))
 
 extern CAN_HandleTypeDef hcan1;
+extern TIM_HandleTypeDef htim2;
+
+//DWT cycle counter, enabled in app_init()
+#define CYCLES()			(DWT->CYCCNT)
+#define CYCLES_TO_US(c)		((c)/(SystemCoreClock/1000000U))
 
 
 #define USB_DP		USB_DP_GPIO_Port, USB_DP_Pin
 #define USB_LED		USB_LED_GPIO_Port, USB_LED_Pin
 #define TX_LED		TX_LED_GPIO_Port, TX_LED_Pin
 #define RX_LED		RX_LED_GPIO_Port, RX_LED_Pin
+#endif /* HOST_TEST */
 
 #endif /* BOARD_H_ */
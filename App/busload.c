@@ -0,0 +1,236 @@
+/*
+ * busload.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "busload.h"
+#include "board.h"
+#include <string.h>
+
+#define CRC15_POLY		0x4599
+#define FRAME_TAIL_BITS	13		//CRC delimiter, ACK slot, ACK delimiter, EOF, IFS
+
+//stuffing state: (last bit << 2) | (run length - 1), run length 1..4
+#define STUFF_STATE(v, r)	(((v) << 2) | ((r) - 1))
+
+static uint16_t crc15_tab[256];
+static uint8_t stuff_tab[8][16];	//per nibble: (stuff bits << 3) | next state, MSB first
+
+static volatile uint32_t total_bits = 0;
+static volatile uint32_t total_frames = 0;
+static volatile uint32_t total_errors = 0;
+
+static uint32_t last_bits = 0;
+static uint32_t last_frames = 0;
+static uint32_t last_errors = 0;
+static uint32_t slice_start = 0;
+static uint32_t win_start = 0;
+static uint32_t win_bits = 0;
+static uint32_t win_frames = 0;
+static uint32_t win_errors = 0;
+static uint16_t win_peak_load = 0;
+static uint32_t win_peak_fps = 0;
+static uint16_t window = 1000;
+
+static Busload_t result;
+
+//
+//Private forwards
+//
+static uint8_t stuff_bit(uint8_t* state, uint8_t bit);
+static uint8_t stuff_byte(uint8_t* state, uint8_t byte);
+static uint16_t permille(uint32_t bits, uint32_t bitrate, uint32_t ms);
+
+//
+//Public members
+//
+void busload_init()
+{
+	for (uint16_t i = 0; i < 256; i++)
+	{
+		uint16_t crc = i << 7;
+		for (uint8_t b = 0; b < 8; b++)
+			crc = (crc & 0x4000)?((crc << 1) ^ CRC15_POLY):(crc << 1);
+		crc15_tab[i] = crc & 0x7FFF;
+	}
+
+	for (uint8_t st = 0; st < 8; st++)
+	{
+		for (uint8_t i = 0; i < 16; i++)
+		{
+			uint8_t state = st;
+			uint8_t stuffs = 0;
+			for (int8_t b = 3; b >= 0; b--)
+				stuffs += stuff_bit(&state, (i >> b) & 1);
+			stuff_tab[st][i] = (stuffs << 3) | state;
+		}
+	}
+
+	memset(&result, 0, sizeof(result));
+}
+
+//
+//Exact on-wire length: SOF..CRC with stuff bits, then the fixed tail.
+//The header is left padded with zeros up to a byte boundary, that doesn't
+//change CRC15 (zero init) and lets both CRC and stuffing run on byte tables.
+//
+FAST_RUN uint16_t busload_frame_bits(uint32_t id, uint8_t ide, uint8_t rtr, uint8_t dlc, const uint8_t* data)
+{
+	uint8_t buf[5 + 8];
+	uint8_t hdr_len;
+	uint8_t first_bits;	//real bits in buf[0]
+	uint8_t len = rtr?0:((dlc > 8)?8:dlc);
+	dlc &= 0x0F;
+	rtr = rtr?1:0;
+
+	if (ide)
+	{
+		//SOF, ID[28:18], SRR, IDE, ID[17:0], RTR, r1, r0, DLC: 39 bits
+		uint64_t v = ((uint64_t)((id >> 18) & 0x7FF) << 27) | (3ULL << 25) | ((uint64_t)(id & 0x3FFFF) << 7) | (rtr << 6) | dlc;
+		for (uint8_t i = 0; i < 5; i++)
+			buf[i] = v >> (8*(4 - i));
+		hdr_len = 5;
+		first_bits = 7;
+	}
+	else
+	{
+		//SOF, ID[10:0], RTR, IDE, r0, DLC: 19 bits
+		uint32_t v = ((id & 0x7FF) << 7) | (rtr << 6) | dlc;
+		buf[0] = v >> 16;
+		buf[1] = v >> 8;
+		buf[2] = v;
+		hdr_len = 3;
+		first_bits = 3;
+	}
+	memcpy(&buf[hdr_len], data, len);
+	len += hdr_len;
+
+	uint16_t crc = 0;
+	for (uint8_t i = 0; i < len; i++)
+		crc = ((crc << 8) ^ crc15_tab[((crc >> 7) ^ buf[i]) & 0xFF]) & 0x7FFF;
+
+	//SOF opens the first run
+	uint8_t state = STUFF_STATE(0, 1);
+	uint8_t stuffs = 0;
+	for (int8_t b = first_bits - 2; b >= 0; b--)
+		stuffs += stuff_bit(&state, (buf[0] >> b) & 1);
+
+	for (uint8_t i = 1; i < len; i++)
+		stuffs += stuff_byte(&state, buf[i]);
+
+	stuffs += stuff_byte(&state, crc >> 7);
+	for (int8_t b = 6; b >= 0; b--)
+		stuffs += stuff_bit(&state, (crc >> b) & 1);
+
+	return (first_bits + 8*(len - 1)) + 15 + stuffs + FRAME_TAIL_BITS;
+}
+
+FAST_RUN void busload_frame(uint16_t bits)
+{
+	total_bits += bits;
+	total_frames++;
+}
+
+FAST_RUN void busload_error()
+{
+	total_bits += BUSLOAD_ERROR_BITS;
+	total_errors++;
+}
+
+void busload_step(uint32_t tick, uint32_t bitrate)
+{
+	uint32_t slice_ms = tick - slice_start;
+	if (slice_ms < BUSLOAD_SLICE) return;
+	slice_start = tick;
+
+	uint32_t bits = total_bits;
+	uint32_t frames = total_frames;
+	uint32_t errors = total_errors;
+	uint32_t d_bits = bits - last_bits;
+	uint32_t d_frames = frames - last_frames;
+	last_bits = bits;
+	last_frames = frames;
+
+	win_bits += d_bits;
+	win_frames += d_frames;
+	win_errors += errors - last_errors;
+	last_errors = errors;
+
+	uint16_t load = permille(d_bits, bitrate, slice_ms);
+	if (load > win_peak_load) win_peak_load = load;
+	uint32_t fps = (d_frames*1000)/slice_ms;
+	if (fps > win_peak_fps) win_peak_fps = fps;
+
+	uint32_t win_ms = tick - win_start;
+	if (win_ms < window) return;
+	win_start = tick;
+
+	result.load_permille = permille(win_bits, bitrate, win_ms);
+	result.peak_load_permille = win_peak_load;
+	result.frames_per_s = ((uint64_t)win_frames*1000)/win_ms;
+	result.peak_frames_per_s = win_peak_fps;
+	result.errors_per_s = ((uint64_t)win_errors*1000)/win_ms;
+
+	win_bits = win_frames = win_errors = 0;
+	win_peak_load = 0;
+	win_peak_fps = 0;
+}
+
+void busload_set_window(uint16_t ms)
+{
+	if (ms < BUSLOAD_SLICE) ms = BUSLOAD_SLICE;
+	window = ms;
+}
+
+uint16_t busload_window()
+{
+	return window;
+}
+
+const Busload_t* busload_get()
+{
+	return &result;
+}
+
+//
+//Private members
+//
+
+//two nibble lookups, a byte table would cost 2 KB of RAM
+static FAST_RUN uint8_t stuff_byte(uint8_t* state, uint8_t byte)
+{
+	uint8_t hi = stuff_tab[*state][byte >> 4];
+	uint8_t lo = stuff_tab[hi & 0x07][byte & 0x0F];
+	*state = lo & 0x07;
+	return (hi >> 3) + (lo >> 3);
+}
+
+static FAST_RUN uint8_t stuff_bit(uint8_t* state, uint8_t bit)
+{
+	uint8_t v = *state >> 2;
+	uint8_t r = (*state & 0x03) + 1;
+
+	if (bit != v)
+	{
+		*state = STUFF_STATE(bit, 1);
+		return 0;
+	}
+
+	if (++r < 5)
+	{
+		*state = STUFF_STATE(v, r);
+		return 0;
+	}
+
+	//five equal bits: the complement is inserted and opens the next run
+	*state = STUFF_STATE(v ^ 1, 1);
+	return 1;
+}
+
+static uint16_t permille(uint32_t bits, uint32_t bitrate, uint32_t ms)
+{
+	if (!bitrate || !ms) return 0;
+	uint64_t pm = ((uint64_t)bits*1000000)/((uint64_t)bitrate*ms);
+	return (pm > 1000)?1000:pm;
+}
@@ -0,0 +1,34 @@
+/*
+ * busload.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef BUSLOAD_H_
+#define BUSLOAD_H_
+#include <stdint.h>
+
+#define BUSLOAD_SLICE			10		//ms, burst rate resolution
+#define BUSLOAD_ERROR_BITS		17		//error flag + delimiter + IFS, the broken frame part is unknown
+
+//! results of the last complete window
+typedef struct
+{
+	uint16_t	load_permille;
+	uint16_t	peak_load_permille;		//busiest slice of the window
+	uint32_t	frames_per_s;
+	uint32_t	peak_frames_per_s;		//busiest slice of the window
+	uint32_t	errors_per_s;
+}Busload_t;
+
+void busload_init();
+uint16_t busload_frame_bits(uint32_t id, uint8_t ide, uint8_t rtr, uint8_t dlc, const uint8_t* data);
+void busload_frame(uint16_t bits);
+void busload_error();
+void busload_step(uint32_t tick, uint32_t bitrate);
+void busload_set_window(uint16_t ms);
+uint16_t busload_window();
+const Busload_t* busload_get();
+
+#endif /* BUSLOAD_H_ */
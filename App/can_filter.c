@@ -0,0 +1,389 @@
+/*
+ * can_filter.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "can_filter.h"
+#include "board.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define STD_KEY_FULL	0x00000FFF	//(11 bit id << 1) | rtr
+#define EXT_KEY_FULL	0x3FFFFFFF	//(29 bit id << 1) | rtr
+
+//! acceptance group, key and mask are (id << 1) | rtr
+typedef struct
+{
+	uint32_t	key;
+	uint32_t	mask;
+	uint8_t		ext;
+	uint8_t		fifo;			//1 - high priority lane
+}Filter_Group_t;
+
+//! register image, written in one go under FINIT
+typedef struct
+{
+	uint32_t	fm1r;
+	uint32_t	fs1r;
+	uint32_t	ffa1r;
+	uint32_t	fa1r;
+	uint32_t	fr[CAN_FILTER_BANKS][2];
+	uint8_t		layout[CAN_FILTER_BANKS];
+	uint8_t		banks;
+}Filter_Image_t;
+
+static Filter_Group_t entries[CAN_FILTER_MAX_ENTRIES];
+static uint16_t entries_count = 0;
+static uint16_t entries_dropped = 0;
+
+static Filter_Group_t groups[CAN_FILTER_MAX_ENTRIES];
+static uint16_t groups_count = 0;
+
+static Filter_Image_t image;
+static uint8_t last_result = 0;
+static uint16_t last_finit_us = 0;
+static uint32_t last_false_accepts = 0;
+
+//
+//Private forwards
+//
+static int group_cmp(const void* a, const void* b);
+static uint8_t group_units(const Filter_Group_t* g);
+static uint64_t group_cover(const Filter_Group_t* g);
+static uint8_t groups_banks();
+static uint8_t merge_step();
+static void build_image();
+static void write_image();
+
+//
+//Public members
+//
+void can_filter_clear()
+{
+	entries_count = 0;
+	entries_dropped = 0;
+}
+
+uint16_t can_filter_add(const CAN_USB_FilterEntry_t* list, uint16_t count)
+{
+	uint16_t added = 0;
+	for (; (added < count) && (entries_count < CAN_FILTER_MAX_ENTRIES); added++)
+	{
+		const CAN_USB_FilterEntry_t* e = &list[added];
+		Filter_Group_t* g = &entries[entries_count++];
+		g->ext = (e->flags & CAN_FENTRY_IDE)?1:0;
+		g->fifo = (e->flags & CAN_FENTRY_PRIO)?1:0;
+
+		uint32_t id_mask = e->mask & (g->ext?0x1FFFFFFF:0x7FF);
+		g->mask = (id_mask << 1) | ((e->flags & CAN_FENTRY_ANY_RTR)?0:1);
+		g->key = (((e->id & id_mask) << 1) | ((e->flags & CAN_FENTRY_RTR)?1:0)) & g->mask;
+	}
+
+	entries_dropped += count - added;
+	return added;
+}
+
+//
+//Exact IDs go to list banks, ranges to mask banks. While the result doesn't
+//fit, neighbouring groups (sorted by key) are merged into masks, the merge
+//saving the most bank space for the fewest extra accepted IDs going first.
+//FIFO1 groups never merge with FIFO0 ones and take the lowest banks, so
+//they win over an overlapping bulk bank of the same mode.
+//The register image is completed in RAM and written under a single FINIT.
+//
+uint8_t can_filter_apply()
+{
+	//entries past CAN_FILTER_MAX_ENTRIES were dropped: don't apply a partial list
+	if (entries_dropped)
+	{
+		last_result = 0;
+		return 0;
+	}
+
+	memcpy(groups, entries, sizeof(Filter_Group_t)*entries_count);
+	groups_count = entries_count;
+	qsort(groups, groups_count, sizeof(Filter_Group_t), group_cmp);
+
+	uint64_t requested = 0;
+	for (uint16_t i = 0; i < groups_count; i++)
+		requested += group_cover(&groups[i]);
+
+	last_result = 1;
+	while (groups_banks() > CAN_FILTER_BANKS)
+	{
+		if (!merge_step())
+		{
+			last_result = 0;
+			return 0;
+		}
+	}
+
+	uint64_t accepted = 0;
+	for (uint16_t i = 0; i < groups_count; i++)
+		accepted += group_cover(&groups[i]);
+	accepted = (accepted > requested)?(accepted - requested):0;
+	last_false_accepts = (accepted > 0xFFFFFFFF)?0xFFFFFFFF:accepted;
+
+	build_image();
+	write_image();
+
+	return 1;
+}
+
+void can_filter_report(CAN_USB_FilterList_t* out)
+{
+	out->result = last_result;
+	out->entries = entries_count;
+	out->banks = image.banks;
+	out->finit_us = last_finit_us;
+	out->false_accepts = last_false_accepts;
+	memcpy(out->layout, image.layout, sizeof(out->layout));
+}
+
+void can_filter_read(uint8_t bank, CAN_USB_Filter_t* out)
+{
+	CAN_TypeDef* can = hcan1.Instance;
+	uint32_t bit = 1U << bank;
+
+	memset(out, 0, sizeof(CAN_USB_Filter_t));
+	if (bank >= CAN_FILTER_BANKS) return;
+
+	uint32_t fr1 = can->sFilterRegister[bank].FR1;
+	uint32_t fr2 = can->sFilterRegister[bank].FR2;
+	if (can->FS1R & bit)
+	{
+		out->FilterIdHigh = fr1 >> 16;
+		out->FilterIdLow = fr1 & 0xFFFF;
+		out->FilterMaskIdHigh = fr2 >> 16;
+		out->FilterMaskIdLow = fr2 & 0xFFFF;
+	}
+	else
+	{
+		//16-bit halves as HAL_CAN_ConfigFilter() lays them out
+		out->FilterIdLow = fr1 & 0xFFFF;
+		out->FilterMaskIdLow = fr1 >> 16;
+		out->FilterIdHigh = fr2 & 0xFFFF;
+		out->FilterMaskIdHigh = fr2 >> 16;
+	}
+	out->FilterFIFOAssignment = (can->FFA1R & bit)?CAN_FILTER_FIFO1:CAN_FILTER_FIFO0;
+	out->FilterBank = bank;
+	out->FilterMode = (can->FM1R & bit)?CAN_FILTERMODE_IDLIST:CAN_FILTERMODE_IDMASK;
+	out->FilterScale = (can->FS1R & bit)?CAN_FILTERSCALE_32BIT:CAN_FILTERSCALE_16BIT;
+	out->FilterActivation = (can->FA1R & bit)?CAN_FILTER_ENABLE:CAN_FILTER_DISABLE;
+	out->SlaveStartFilterBank = (can->FMR & CAN_FMR_CAN2SB) >> CAN_FMR_CAN2SB_Pos;
+}
+
+//
+//Private members
+//
+static int group_cmp(const void* a, const void* b)
+{
+	const Filter_Group_t* ga = (const Filter_Group_t*)a;
+	const Filter_Group_t* gb = (const Filter_Group_t*)b;
+
+	if (ga->fifo != gb->fifo) return gb->fifo - ga->fifo;
+	if (ga->ext != gb->ext) return ga->ext - gb->ext;
+	if (ga->key != gb->key) return (ga->key < gb->key)?-1:1;
+	return 0;
+}
+
+//quarter banks: list16 slot 1, mask16 slot 2, list32 slot 2, mask32 slot 4
+static uint8_t group_units(const Filter_Group_t* g)
+{
+	uint8_t exact = (g->mask == (g->ext?EXT_KEY_FULL:STD_KEY_FULL));
+	if (g->ext) return exact?2:4;
+	return exact?1:2;
+}
+
+static uint64_t group_cover(const Filter_Group_t* g)
+{
+	uint8_t width = g->ext?30:12;
+	return 1ULL << (width - __builtin_popcount(g->mask));
+}
+
+static uint8_t groups_banks()
+{
+	uint16_t n[2][5];	//by FIFO and CAN_FLAYOUT_xxx, a bank serves one FIFO
+	memset(n, 0, sizeof(n));
+	for (uint16_t i = 0; i < groups_count; i++)
+	{
+		uint8_t u = group_units(&groups[i]);
+		uint16_t* f = n[groups[i].fifo];
+		if (groups[i].ext) f[(u == 2)?CAN_FLAYOUT_LIST32:CAN_FLAYOUT_MASK32]++;
+		else f[(u == 1)?CAN_FLAYOUT_LIST16:CAN_FLAYOUT_MASK16]++;
+	}
+
+	uint16_t banks = 0;
+	for (uint8_t i = 0; i < 2; i++)
+		banks += (n[i][CAN_FLAYOUT_LIST16] + 3)/4 + (n[i][CAN_FLAYOUT_MASK16] + 1)/2 + (n[i][CAN_FLAYOUT_LIST32] + 1)/2 + n[i][CAN_FLAYOUT_MASK32];
+	return (banks > 0xFF)?0xFF:banks;
+}
+
+//
+//Merging two exact standard IDs into a mask saves nothing by itself, such
+//merges are taken only when nothing saves space, they pay off on the next step.
+//
+static uint8_t merge_step()
+{
+	int16_t best = -1;
+	int8_t best_save = 0;
+	uint64_t best_added = 0;
+
+	for (uint16_t i = 0; (i + 1) < groups_count; i++)
+	{
+		Filter_Group_t* a = &groups[i];
+		Filter_Group_t* b = &groups[i + 1];
+		if ((a->ext != b->ext) || (a->fifo != b->fifo)) continue;
+
+		Filter_Group_t m;
+		m.ext = a->ext;
+		m.fifo = a->fifo;
+		m.mask = a->mask & b->mask & ~(a->key ^ b->key);
+		m.key = a->key & m.mask;
+
+		int8_t save = group_units(a) + group_units(b) - group_units(&m);
+		uint64_t cover = group_cover(a) + group_cover(b);
+		uint64_t added = group_cover(&m);
+		added = (added > cover)?(added - cover):0;
+
+		//compare added/save without dividing, save 0 ranks below any saving
+		uint8_t better;
+		if (best < 0) better = 1;
+		else if ((save > 0) != (best_save > 0)) better = (save > 0);
+		else if (save <= 0) better = (added < best_added);
+		else better = ((added*best_save) < (best_added*save));
+
+		if (better)
+		{
+			best = i;
+			best_save = save;
+			best_added = added;
+		}
+	}
+
+	if (best < 0) return 0;
+
+	Filter_Group_t* a = &groups[best];
+	Filter_Group_t* b = &groups[best + 1];
+	a->mask = a->mask & b->mask & ~(a->key ^ b->key);
+	a->key &= a->mask;
+	groups_count--;
+	memmove(b, b + 1, sizeof(Filter_Group_t)*(groups_count - best - 1));
+
+	return 1;
+}
+
+static void build_image()
+{
+	uint32_t slots[CAN_FILTER_BANKS*4];
+	uint8_t n;
+
+	memset(&image, 0, sizeof(image));
+
+	//one pass per FIFO and layout, partial banks repeat their last slot
+	for (uint8_t pass = 0; pass < 2*CAN_FLAYOUT_MASK32; pass++)
+	{
+		uint8_t fifo = (pass < CAN_FLAYOUT_MASK32)?1:0;
+		uint8_t layout = CAN_FLAYOUT_LIST16 + pass%CAN_FLAYOUT_MASK32;
+		uint8_t per_bank = (layout == CAN_FLAYOUT_LIST16)?4:2;	//slots, a mask32 group takes two
+		n = 0;
+
+		for (uint16_t i = 0; i < groups_count; i++)
+		{
+			Filter_Group_t* g = &groups[i];
+			if (g->fifo != fifo) continue;
+			uint8_t u = group_units(g);
+			uint8_t l;
+			if (g->ext) l = (u == 2)?CAN_FLAYOUT_LIST32:CAN_FLAYOUT_MASK32;
+			else l = (u == 1)?CAN_FLAYOUT_LIST16:CAN_FLAYOUT_MASK16;
+			if (l != layout) continue;
+
+			uint32_t v, m;
+			if (g->ext)
+			{
+				v = ((g->key >> 1) << 3) | CAN_ID_EXT | ((g->key & 1) << 1);
+				m = ((g->mask >> 1) << 3) | CAN_ID_EXT | ((g->mask & 1) << 1);
+			}
+			else
+			{
+				//16 bit: STID[10:0] RTR IDE EXID[17:15]
+				v = ((g->key >> 1) << 5) | ((g->key & 1) << 4);
+				m = ((g->mask >> 1) << 5) | ((g->mask & 1) << 4) | (1 << 3);
+			}
+
+			switch(layout)
+			{
+				case CAN_FLAYOUT_LIST16:
+				case CAN_FLAYOUT_LIST32:
+					slots[n++] = v;
+					break;
+				case CAN_FLAYOUT_MASK16:
+					slots[n++] = (m << 16) | v;
+					break;
+				case CAN_FLAYOUT_MASK32:
+					slots[n++] = v;
+					slots[n++] = m;
+					break;
+			}
+		}
+
+		if (!n) continue;
+		while (n % per_bank)
+		{
+			slots[n] = slots[n - 1];
+			n++;
+		}
+
+		for (uint8_t i = 0; i < n; i += per_bank)
+		{
+			uint8_t bank = image.banks++;
+			uint32_t bit = 1U << bank;
+			uint32_t* fr = image.fr[bank];
+
+			image.layout[bank] = layout;
+			image.fa1r |= bit;
+			if (fifo) image.ffa1r |= bit;
+			if ((layout == CAN_FLAYOUT_LIST16) || (layout == CAN_FLAYOUT_LIST32)) image.fm1r |= bit;
+			if ((layout == CAN_FLAYOUT_LIST32) || (layout == CAN_FLAYOUT_MASK32)) image.fs1r |= bit;
+
+			if (layout == CAN_FLAYOUT_LIST16)
+			{
+				fr[0] = (slots[i + 1] << 16) | slots[i];
+				fr[1] = (slots[i + 3] << 16) | slots[i + 2];
+			}
+			else
+			{
+				fr[0] = slots[i];
+				fr[1] = slots[i + 1];
+			}
+		}
+	}
+}
+
+static void write_image()
+{
+	CAN_TypeDef* can = hcan1.Instance;
+
+	__disable_irq();
+	uint32_t start = CYCLES();
+
+	//CAN2SB = 28: every bank belongs to CAN1
+	can->FMR = (can->FMR & ~CAN_FMR_CAN2SB) | (CAN_FILTER_BANKS << CAN_FMR_CAN2SB_Pos) | CAN_FMR_FINIT;
+	can->FA1R = 0;
+	can->FM1R = image.fm1r;
+	can->FS1R = image.fs1r;
+	can->FFA1R = image.ffa1r;
+	for (uint8_t i = 0; i < image.banks; i++)
+	{
+		can->sFilterRegister[i].FR1 = image.fr[i][0];
+		can->sFilterRegister[i].FR2 = image.fr[i][1];
+	}
+	can->FA1R = image.fa1r;
+	can->FMR &= ~CAN_FMR_FINIT;
+
+	uint32_t us = CYCLES_TO_US(CYCLES() - start);
+	__enable_irq();
+
+	last_finit_us = (us > 0xFFFF)?0xFFFF:us;
+}
@@ -0,0 +1,20 @@
+/*
+ * can_filter.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef CAN_FILTER_H_
+#define CAN_FILTER_H_
+#include "proto.h"
+
+#define CAN_FILTER_MAX_ENTRIES		128
+
+void can_filter_clear();
+uint16_t can_filter_add(const CAN_USB_FilterEntry_t* entries, uint16_t count);
+uint8_t can_filter_apply();
+void can_filter_report(CAN_USB_FilterList_t* out);
+void can_filter_read(uint8_t bank, CAN_USB_Filter_t* out);
+
+#endif /* CAN_FILTER_H_ */
@@ -0,0 +1,164 @@
+/*
+ * can_pack.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "can_pack.h"
+#include <string.h>
+
+//
+//Private forwards
+//
+static uint8_t flags_byte(const CAN_USB_Mess_t* mess);
+static uint8_t data_len(const CAN_USB_Mess_t* mess);
+
+//
+//Public members
+//
+void can_pack_reset(Can_Pack_Slot_t* dict)
+{
+	memset(dict, 0, sizeof(Can_Pack_Slot_t)*CAN_PACK_SLOTS);
+}
+
+//
+//Encodes mess for its dictionary slot and remembers it as the slot value.
+//A keyframe goes out for a new slot, a flags/filter change and every
+//key_every deltas, so a decoder which joined late catches up by itself.
+//
+uint8_t can_pack_record(Can_Pack_Slot_t* dict, uint8_t slot, const CAN_USB_Mess_t* mess, uint8_t key_every, uint8_t* out)
+{
+	Can_Pack_Slot_t* s = &dict[slot];
+	uint8_t flags = flags_byte(mess);
+	uint8_t len = 0;
+
+	if (s->valid && (flags_byte(&s->mess) == flags) && (s->mess.filter == mess->filter) && (s->deltas < key_every))
+	{
+		uint8_t mask = 0;
+		uint8_t diff[8];
+		uint8_t n = 0;
+		for (uint8_t i = 0; i < data_len(mess); i++)
+		{
+			uint8_t x = mess->data[i] ^ s->mess.data[i];
+			if (!x) continue;
+			mask |= 1 << i;
+			diff[n++] = x;
+		}
+
+		out[len++] = mask?CAN_PACK_DELTA:CAN_PACK_SAME;
+		out[len++] = slot;
+		if (mask)
+		{
+			out[len++] = mask;
+			memcpy(&out[len], diff, n);
+			len += n;
+		}
+		s->deltas++;
+	}
+	else
+	{
+		out[len++] = CAN_PACK_KEY | flags;
+		out[len++] = slot;
+		out[len++] = mess->id;
+		out[len++] = mess->id >> 8;
+		if (mess->flags.ide)
+		{
+			out[len++] = mess->id >> 16;
+			out[len++] = mess->id >> 24;
+		}
+		out[len++] = mess->filter;
+		memcpy(&out[len], mess->data, data_len(mess));
+		len += data_len(mess);
+		s->valid = 1;
+		s->deltas = 0;
+	}
+
+	s->mess = *mess;
+	return len;
+}
+
+//
+//Decodes one record of a CAN_PT_PACKED payload, returns bytes used, 0 on a
+//malformed record (drop the rest of the packet). valid is 0 if the record
+//carried no frame: a reset, or a delta for a slot not seen since the last
+//keyframe.
+//
+uint8_t can_unpack_record(Can_Pack_Slot_t* dict, const uint8_t* in, uint8_t len, CAN_USB_Mess_t* out, uint8_t* valid)
+{
+	*valid = 0;
+	if (!len) return 0;
+
+	uint8_t tag = in[0];
+	if (tag == CAN_PACK_RESET)
+	{
+		can_pack_reset(dict);
+		return 1;
+	}
+
+	if (len < 2) return 0;
+	Can_Pack_Slot_t* s = &dict[in[1]];
+	uint8_t used = 2;
+
+	if (tag & CAN_PACK_KEY)
+	{
+		CAN_USB_Mess_t mess;
+		memset(&mess, 0, sizeof(mess));
+		tag &= ~CAN_PACK_KEY;
+		memcpy(&mess.flags, &tag, 1);
+
+		uint8_t id_len = mess.flags.ide?4:2;
+		if (len < (used + id_len + 1)) return 0;
+		for (uint8_t i = 0; i < id_len; i++)
+			mess.id |= (uint32_t)in[used++] << (8*i);
+		mess.filter = in[used++];
+
+		uint8_t n = data_len(&mess);
+		if (len < (used + n)) return 0;
+		memcpy(mess.data, &in[used], n);
+		used += n;
+
+		s->mess = mess;
+		s->valid = 1;
+	}
+	else if (tag == CAN_PACK_DELTA)
+	{
+		if (len < 3) return 0;
+		uint8_t mask = in[used++];
+		uint8_t n = 0;
+		for (uint8_t i = 0; i < 8; i++)
+			n += (mask >> i) & 1;
+		if (len < (used + n)) return 0;
+
+		for (uint8_t i = 0; i < 8; i++)
+		{
+			if (mask & (1 << i))
+				s->mess.data[i] ^= in[used++];
+		}
+	}
+	else if (tag != CAN_PACK_SAME)
+		return 0;
+
+	if (s->valid)
+	{
+		*out = s->mess;
+		*valid = 1;
+	}
+
+	return used;
+}
+
+//
+//Private members
+//
+static uint8_t flags_byte(const CAN_USB_Mess_t* mess)
+{
+	uint8_t b;
+	memcpy(&b, &mess->flags, 1);
+	return b & ~CAN_PACK_KEY;
+}
+
+static uint8_t data_len(const CAN_USB_Mess_t* mess)
+{
+	if (mess->flags.rtr) return 0;
+	return (mess->flags.dlc > 8)?8:mess->flags.dlc;
+}
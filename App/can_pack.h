@@ -0,0 +1,27 @@
+/*
+ * can_pack.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef CAN_PACK_H_
+#define CAN_PACK_H_
+#include "proto.h"
+
+#define CAN_PACK_SLOTS			256
+#define CAN_PACK_RECORD_MAX		(1 + 1 + 4 + 1 + 8)		//keyframe of an extended frame
+
+//! last value of a dictionary slot, both ends keep the same copy
+typedef struct
+{
+	CAN_USB_Mess_t	mess;
+	uint8_t			valid;
+	uint8_t			deltas;				//encoder: deltas since the last keyframe
+}Can_Pack_Slot_t;
+
+void can_pack_reset(Can_Pack_Slot_t* dict);
+uint8_t can_pack_record(Can_Pack_Slot_t* dict, uint8_t slot, const CAN_USB_Mess_t* mess, uint8_t key_every, uint8_t* out);
+uint8_t can_unpack_record(Can_Pack_Slot_t* dict, const uint8_t* in, uint8_t len, CAN_USB_Mess_t* out, uint8_t* valid);
+
+#endif /* CAN_PACK_H_ */
@@ -0,0 +1,105 @@
+/*
+ * data_filter.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "data_filter.h"
+#include "id_map.h"
+#include "board.h"
+#include <string.h>
+
+//! rule compiled to a whole payload compare
+typedef struct
+{
+	uint32_t	key;
+	uint32_t	key_mask;
+	uint32_t	value[2];
+	uint32_t	mask[2];
+	uint8_t		min_dlc;			//masked bytes must be present
+}Data_Rule_t;
+
+static Data_Rule_t rules[DATA_FILTER_RULES];
+static uint8_t rules_count = 0;
+static uint32_t dropped = 0;
+
+//
+//Public members
+//
+void data_filter_clear()
+{
+	__disable_irq();
+	rules_count = 0;
+	dropped = 0;
+	__enable_irq();
+}
+
+uint8_t data_filter_add(const CAN_USB_DataRule_t* rule)
+{
+	if (rules_count >= DATA_FILTER_RULES) return 0;
+	if (rule->offset > 7) return 0;
+
+	uint8_t ide = rule->flags & CAN_FENTRY_IDE;
+	uint32_t full = ide?0x1FFFFFFF:0x7FF;
+
+	Data_Rule_t r;
+	r.key_mask = ID_MAP_KEY(rule->id_mask & full, 1);
+	r.key = ID_MAP_KEY(rule->id, ide) & r.key_mask;
+
+	uint8_t value[8], mask[8];
+	memset(value, 0, sizeof(value));
+	memset(mask, 0, sizeof(mask));
+	r.min_dlc = 0;
+	for (uint8_t i = 0; (i < 4) && ((rule->offset + i) < 8); i++)
+	{
+		mask[rule->offset + i] = rule->mask >> (8*i);
+		value[rule->offset + i] = (rule->value >> (8*i)) & mask[rule->offset + i];
+		if (mask[rule->offset + i]) r.min_dlc = rule->offset + i + 1;
+	}
+	memcpy(r.value, value, sizeof(r.value));
+	memcpy(r.mask, mask, sizeof(r.mask));
+
+	__disable_irq();
+	rules[rules_count++] = r;
+	__enable_irq();
+
+	return 1;
+}
+
+//
+//Called from the RX ISR, 1 - keep the frame. IDs no rule covers always
+//pass, covered ones need any of their rules to match. At most
+//DATA_FILTER_RULES ID compares plus two masked word compares each.
+//
+FAST_RUN uint8_t data_filter_pass(const CAN_USB_Mess_t* mess)
+{
+	if (!rules_count) return 1;
+
+	uint32_t key = ID_MAP_KEY(mess->id, mess->flags.ide);
+	uint8_t dlc = mess->flags.rtr?0:mess->flags.dlc;
+	uint8_t covered = 0;
+	uint32_t d[2];
+	memcpy(d, mess->data, sizeof(d));
+
+	for (uint8_t i = 0; i < rules_count; i++)
+	{
+		const Data_Rule_t* r = &rules[i];
+		if ((key & r->key_mask) != r->key) continue;
+
+		covered = 1;
+		if ((dlc >= r->min_dlc) && ((d[0] & r->mask[0]) == r->value[0]) && ((d[1] & r->mask[1]) == r->value[1]))
+			return 1;
+	}
+
+	if (!covered) return 1;
+
+	dropped++;
+	return 0;
+}
+
+void data_filter_stat(CAN_USB_DataFilterStat_t* out)
+{
+	out->rules = rules_count;
+	out->capacity = DATA_FILTER_RULES;
+	out->dropped = dropped;
+}
@@ -0,0 +1,19 @@
+/*
+ * data_filter.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef DATA_FILTER_H_
+#define DATA_FILTER_H_
+#include "proto.h"
+
+#define DATA_FILTER_RULES		16
+
+void data_filter_clear();
+uint8_t data_filter_add(const CAN_USB_DataRule_t* rule);
+uint8_t data_filter_pass(const CAN_USB_Mess_t* mess);
+void data_filter_stat(CAN_USB_DataFilterStat_t* out);
+
+#endif /* DATA_FILTER_H_ */
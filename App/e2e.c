@@ -0,0 +1,273 @@
+/*
+ * e2e.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "e2e.h"
+#include "id_map.h"
+#include "board.h"
+#include <string.h>
+
+#define CRC8_J1850_POLY		0x1D
+#define CRC8_H2F_POLY		0x2F
+#define COUNTER_NONE		0xFF
+
+//! protected ID, counter and CRC positions are checked when it is set
+typedef struct
+{
+	uint32_t	key;
+	uint16_t	data_id;
+	uint8_t		flags;				//CAN_E2E_xxx
+	uint8_t		crc_byte;
+	uint8_t		counter_byte;
+	uint8_t		counter_shift;
+	uint8_t		counter_mask;		//field width, unshifted
+	uint8_t		counter_max;		//counter wraps to 0 after it
+	uint8_t		max_delta;			//bigger counter steps on RX are lost frames
+	uint8_t		counter;			//next TX value or last RX value
+	uint8_t		used;
+}E2e_t;
+
+static uint8_t crc_tab[2][256];		//J1850, H2F
+static E2e_t entries[E2E_ENTRIES];
+static uint16_t crc_errors[E2E_ENTRIES];
+static uint16_t seq_errors[E2E_ENTRIES];
+static uint32_t map_keys[1 << E2E_BITS];
+static uint16_t map_items[1 << E2E_BITS];
+static Id_Map_t map;
+
+static uint32_t tx_filled = 0;
+static uint32_t rx_ok = 0;
+static uint32_t rx_crc = 0;
+static uint32_t rx_repeated = 0;
+static uint32_t rx_lost = 0;
+
+//
+//Private forwards
+//
+static uint8_t calc_crc(const E2e_t* e, const uint8_t* data, uint8_t dlc);
+static E2e_t* find(const CAN_USB_Mess_t* mess, uint8_t dir);
+
+//
+//Public members
+//
+void e2e_init()
+{
+	const uint8_t poly[2] = {CRC8_J1850_POLY, CRC8_H2F_POLY};
+	for (uint8_t t = 0; t < 2; t++)
+	{
+		for (uint16_t i = 0; i < 256; i++)
+		{
+			uint8_t crc = i;
+			for (uint8_t b = 0; b < 8; b++)
+				crc = (crc & 0x80)?((crc << 1) ^ poly[t]):(crc << 1);
+			crc_tab[t][i] = crc;
+		}
+	}
+
+	id_map_init(&map, map_keys, map_items, E2E_BITS);
+	e2e_clear();
+}
+
+void e2e_clear()
+{
+	__disable_irq();
+	id_map_clear(&map);
+	memset(entries, 0, sizeof(entries));
+	memset(crc_errors, 0, sizeof(crc_errors));
+	memset(seq_errors, 0, sizeof(seq_errors));
+	tx_filled = rx_ok = rx_crc = rx_repeated = rx_lost = 0;
+	__enable_irq();
+}
+
+uint8_t e2e_set(const CAN_USB_E2e_t* entry)
+{
+	if (entry->op == CAN_E2E_CLEAR)
+	{
+		e2e_clear();
+		return 1;
+	}
+	if (entry->index >= E2E_ENTRIES) return 0;
+	E2e_t* e = &entries[entry->index];
+
+	switch(entry->op)
+	{
+		case CAN_E2E_SET:
+		{
+			uint8_t ide = entry->flags & CAN_E2E_IDE;
+			E2e_t n;
+			n.key = ID_MAP_KEY(entry->id, ide);
+			n.data_id = entry->data_id;
+			n.flags = entry->flags;
+			n.crc_byte = entry->crc_byte;
+			n.counter_byte = entry->counter_byte;
+			n.counter_shift = entry->counter_shift;
+			n.counter_mask = 1;
+			while (n.counter_mask < entry->counter_max)
+				n.counter_mask = (n.counter_mask << 1) | 1;
+			n.counter_max = entry->counter_max;
+			n.max_delta = entry->max_delta?entry->max_delta:1;
+			n.counter = COUNTER_NONE;
+			n.used = 1;
+
+			if ((n.crc_byte > 7) || (n.counter_byte > 7) || (n.counter_shift > 7)) return 0;
+			if ((n.crc_byte == n.counter_byte) || !n.counter_max) return 0;
+			if ((n.counter_mask << n.counter_shift) > 0xFF) return 0;
+			if (n.max_delta > n.counter_max) return 0;
+
+			uint16_t other = id_map_find(&map, n.key);
+			if ((other != ID_MAP_NONE) && (other != entry->index)) return 0;
+
+			__disable_irq();
+			if (e->used) id_map_remove(&map, e->key);
+			id_map_insert(&map, n.key, entry->index);
+			*e = n;
+			crc_errors[entry->index] = seq_errors[entry->index] = 0;
+			__enable_irq();
+			return 1;
+		}
+		case CAN_E2E_REMOVE:
+		{
+			if (!e->used) return 1;
+
+			__disable_irq();
+			id_map_remove(&map, e->key);
+			e->used = 0;
+			__enable_irq();
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+//
+//Called at mailbox load time by every TX path: the counter follows the
+//frames that really go out, not what the host happened to send.
+//data holds a copy of the payload and gets counter and CRC. The counter
+//only moves on with e2e_tx_sent() once the mailbox took the frame.
+//
+FAST_RUN uint8_t e2e_tx(const CAN_USB_Mess_t* mess, uint8_t* data)
+{
+	E2e_t* e = find(mess, CAN_E2E_TX);
+	if (!e) return E2E_NONE;
+
+	uint8_t cnt = (e->counter == COUNTER_NONE)?0:e->counter;
+	uint8_t mask = e->counter_mask << e->counter_shift;
+	data[e->counter_byte] = (data[e->counter_byte] & ~mask) | (cnt << e->counter_shift);
+	data[e->crc_byte] = calc_crc(e, data, mess->flags.dlc);
+	return e - entries;
+}
+
+FAST_RUN void e2e_tx_sent(uint8_t entry)
+{
+	if (entry >= E2E_ENTRIES) return;
+
+	E2e_t* e = &entries[entry];
+	uint8_t cnt = (e->counter == COUNTER_NONE)?0:e->counter;
+	e->counter = (cnt >= e->counter_max)?0:(cnt + 1);
+	tx_filled++;
+}
+
+//
+//Called from the RX ISR. The first frame of an ID only sets the counter,
+//after that a repeated counter or a step above max_delta is a sequence error.
+//
+FAST_RUN void e2e_rx(const CAN_USB_Mess_t* mess)
+{
+	E2e_t* e = find(mess, CAN_E2E_RX);
+	if (!e) return;
+	uint8_t i = e - entries;
+
+	if (calc_crc(e, mess->data, mess->flags.dlc) != mess->data[e->crc_byte])
+	{
+		if (crc_errors[i] < 0xFFFF) crc_errors[i]++;
+		rx_crc++;
+		return;
+	}
+
+	uint8_t cnt = (mess->data[e->counter_byte] >> e->counter_shift) & e->counter_mask;
+	if (cnt > e->counter_max)
+	{
+		//out of range, e.g. 15 with profile 1: no sequence to compare with
+		if (seq_errors[i] < 0xFFFF) seq_errors[i]++;
+		rx_lost++;
+		e->counter = COUNTER_NONE;
+		return;
+	}
+	if (e->counter != COUNTER_NONE)
+	{
+		uint8_t delta = (cnt + e->counter_max + 1 - e->counter) % (e->counter_max + 1);
+		if (!delta || (delta > e->max_delta))
+		{
+			if (seq_errors[i] < 0xFFFF) seq_errors[i]++;
+			if (!delta) rx_repeated++;
+			else rx_lost++;
+		}
+	}
+	e->counter = cnt;
+	rx_ok++;
+}
+
+uint32_t e2e_errors()
+{
+	return rx_crc + rx_repeated + rx_lost;
+}
+
+void e2e_stat(CAN_USB_E2eStat_t* out)
+{
+	out->entries = map.count;
+	out->capacity = E2E_ENTRIES;
+	out->tx_filled = tx_filled;
+	out->rx_ok = rx_ok;
+	out->rx_crc = rx_crc;
+	out->rx_repeated = rx_repeated;
+	out->rx_lost = rx_lost;
+	for (uint8_t i = 0; i < E2E_ENTRIES; i++)
+	{
+		out->entry[i].counter = entries[i].counter;
+		out->entry[i].crc_errors = crc_errors[i];
+		out->entry[i].seq_errors = seq_errors[i];
+	}
+}
+
+//
+//Private members
+//
+
+//
+//CRC8 with 0xFF start and final XOR, as the AUTOSAR library. The data ID
+//goes first, low byte then high byte, then the payload without the CRC byte.
+//
+static FAST_RUN uint8_t calc_crc(const E2e_t* e, const uint8_t* data, uint8_t dlc)
+{
+	const uint8_t* tab = crc_tab[(e->flags & CAN_E2E_H2F)?1:0];
+	uint8_t crc = 0xFF;
+
+	crc = tab[crc ^ (e->data_id & 0xFF)];
+	if (e->flags & CAN_E2E_ID16)
+		crc = tab[crc ^ (e->data_id >> 8)];
+
+	if (dlc > 8) dlc = 8;
+	for (uint8_t i = 0; i < dlc; i++)
+	{
+		if (i == e->crc_byte) continue;
+		crc = tab[crc ^ data[i]];
+	}
+
+	return crc ^ 0xFF;
+}
+
+static FAST_RUN E2e_t* find(const CAN_USB_Mess_t* mess, uint8_t dir)
+{
+	if (!map.count || mess->flags.rtr || mess->flags.echo) return 0;
+
+	uint16_t item = id_map_find(&map, ID_MAP_KEY(mess->id, mess->flags.ide));
+	if (item == ID_MAP_NONE) return 0;
+
+	E2e_t* e = &entries[item];
+	if (!(e->flags & dir)) return 0;
+	if ((mess->flags.dlc <= e->crc_byte) || (mess->flags.dlc <= e->counter_byte)) return 0;
+	return e;
+}
@@ -0,0 +1,25 @@
+/*
+ * e2e.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef E2E_H_
+#define E2E_H_
+#include "proto.h"
+
+#define E2E_ENTRIES			16
+#define E2E_BITS			5		//ID map slots, 2x the entries
+#define E2E_NONE			0xFF	//e2e_tx(): the frame has no TX entry
+
+void e2e_init();
+void e2e_clear();
+uint8_t e2e_set(const CAN_USB_E2e_t* entry);
+uint8_t e2e_tx(const CAN_USB_Mess_t* mess, uint8_t* data);
+void e2e_tx_sent(uint8_t entry);
+void e2e_rx(const CAN_USB_Mess_t* mess);
+uint32_t e2e_errors();
+void e2e_stat(CAN_USB_E2eStat_t* out);
+
+#endif /* E2E_H_ */
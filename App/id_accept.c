@@ -0,0 +1,174 @@
+/*
+ * id_accept.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "id_accept.h"
+#include "board.h"
+#include <string.h>
+
+//! extended range too wide to enumerate
+typedef struct
+{
+	uint32_t	id;
+	uint32_t	mask;
+}ID_Range_t;
+
+volatile uint8_t id_accept_on = 0;
+uint32_t id_accept_std[2048/32];
+
+static uint32_t ext_set[ID_ACCEPT_EXT_SLOTS];
+static uint16_t ext_count = 0;
+static uint16_t ext_max_probe = 0;
+static ID_Range_t ext_ranges[ID_ACCEPT_EXT_RANGES];
+static uint8_t ext_ranges_count = 0;
+static uint8_t ready = 0;
+static uint8_t wanted = 0;
+static uint16_t rejected = 0;		//entries that didn't fit since the last clear
+
+//
+//Private forwards
+//
+static uint32_t ext_hash(uint32_t id);
+static uint8_t ext_insert(uint32_t id);
+
+//
+//Public members
+//
+void id_accept_clear()
+{
+	id_accept_on = 0;
+	ready = 0;
+	memset(id_accept_std, 0, sizeof(id_accept_std));
+	memset(ext_set, 0xFF, sizeof(ext_set));
+	ext_count = 0;
+	ext_max_probe = 0;
+	ext_ranges_count = 0;
+	rejected = 0;
+}
+
+//
+//0 - the entry didn't fit, the list is refused on apply until the next clear
+//
+uint8_t id_accept_add(uint32_t id, uint32_t mask, uint8_t ide)
+{
+	if (!ide)
+	{
+		mask &= 0x7FF;
+		id &= mask;
+		//walk only the don't care bits
+		uint32_t free_bits = ~mask & 0x7FF;
+		uint32_t sub = 0;
+		do
+		{
+			uint32_t v = id | sub;
+			id_accept_std[v >> 5] |= 1U << (v & 0x1F);
+			sub = (sub - free_bits) & free_bits;
+		}while (sub);
+
+		return 1;
+	}
+
+	mask &= 0x1FFFFFFF;
+	id &= mask;
+	uint32_t free_bits = ~mask & 0x1FFFFFFF;
+	if ((1U << __builtin_popcount(free_bits)) <= ID_ACCEPT_ENUM_LIMIT)
+	{
+		uint32_t sub = 0;
+		do
+		{
+			if (!ext_insert(id | sub))
+			{
+				rejected++;
+				return 0;
+			}
+			sub = (sub - free_bits) & free_bits;
+		}while (sub);
+
+		return 1;
+	}
+
+	if (ext_ranges_count >= ID_ACCEPT_EXT_RANGES)
+	{
+		rejected++;
+		return 0;
+	}
+	ext_ranges[ext_ranges_count].id = id;
+	ext_ranges[ext_ranges_count].mask = mask;
+	ext_ranges_count++;
+
+	return 1;
+}
+
+uint16_t id_accept_rejected()
+{
+	return rejected;
+}
+
+//the set only goes live once a complete list was applied
+uint8_t id_accept_commit()
+{
+	if (rejected) return 0;
+	ready = 1;
+	id_accept_on = wanted;
+	return 1;
+}
+
+void id_accept_enable(uint8_t on)
+{
+	wanted = on?1:0;
+	id_accept_on = wanted && ready;
+}
+
+uint8_t id_accept_enabled()
+{
+	return wanted;
+}
+
+FAST_RUN uint8_t id_accept_ext(uint32_t id)
+{
+	uint32_t h = ext_hash(id);
+	for (uint16_t i = 0; i <= ext_max_probe; i++)
+	{
+		uint32_t v = ext_set[(h + i) & (ID_ACCEPT_EXT_SLOTS - 1)];
+		if (v == id) return 1;
+		if (v == ID_ACCEPT_EXT_EMPTY) break;
+	}
+
+	for (uint8_t i = 0; i < ext_ranges_count; i++)
+		if (!((id ^ ext_ranges[i].id) & ext_ranges[i].mask)) return 1;
+
+	return 0;
+}
+
+//
+//Private members
+//
+static inline uint32_t ext_hash(uint32_t id)
+{
+	return (id*0x9E3779B1U) >> (32 - ID_ACCEPT_EXT_BITS);
+}
+
+//
+//Half the slots at most, as id_map: the set always has empty slots, so a
+//lookup ends at the first one and the longest probe stays short.
+//
+static uint8_t ext_insert(uint32_t id)
+{
+	uint32_t h = ext_hash(id);
+	for (uint16_t i = 0; i < ID_ACCEPT_EXT_SLOTS; i++)
+	{
+		uint32_t* slot = &ext_set[(h + i) & (ID_ACCEPT_EXT_SLOTS - 1)];
+		if (*slot == id) return 1;
+		if (*slot != ID_ACCEPT_EXT_EMPTY) continue;
+		if (ext_count >= ID_ACCEPT_EXT_MAX) return 0;
+
+		*slot = id;
+		ext_count++;
+		if (i > ext_max_probe) ext_max_probe = i;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * id_accept.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef ID_ACCEPT_H_
+#define ID_ACCEPT_H_
+#include <stdint.h>
+
+#define ID_ACCEPT_EXT_BITS		9
+#define ID_ACCEPT_EXT_SLOTS		(1 << ID_ACCEPT_EXT_BITS)
+#define ID_ACCEPT_EXT_EMPTY		0xFFFFFFFF
+#define ID_ACCEPT_EXT_RANGES	8
+#define ID_ACCEPT_EXT_MAX		(ID_ACCEPT_EXT_SLOTS/2)	//load limit, keeps probes short
+#define ID_ACCEPT_ENUM_LIMIT	64		//extended ranges up to this size go to the hash set
+
+extern volatile uint8_t id_accept_on;
+extern uint32_t id_accept_std[2048/32];
+
+void id_accept_clear();
+uint8_t id_accept_add(uint32_t id, uint32_t mask, uint8_t ide);
+uint16_t id_accept_rejected();
+uint8_t id_accept_commit();
+void id_accept_enable(uint8_t on);
+uint8_t id_accept_enabled();
+uint8_t id_accept_ext(uint32_t id);
+
+//! second stage after the hardware filters, 1 - frame is wanted
+static inline uint8_t id_accept(uint32_t id, uint8_t ide)
+{
+	if (!id_accept_on) return 1;
+	if (!ide) return (id_accept_std[(id >> 5) & 0x3F] >> (id & 0x1F)) & 1;
+	return id_accept_ext(id);
+}
+
+#endif /* ID_ACCEPT_H_ */
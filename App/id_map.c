@@ -0,0 +1,100 @@
+/*
+ * id_map.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "id_map.h"
+#include "board.h"
+#include <string.h>
+
+#define HASH(map, key)	(((key)*0x9E3779B1U) >> (map)->shift)
+
+void id_map_init(Id_Map_t* map, uint32_t* keys, uint16_t* items, uint8_t bits)
+{
+	map->keys = keys;
+	map->items = items;
+	map->mask = (1U << bits) - 1;
+	map->shift = 32 - bits;
+	map->limit = (map->mask + 1)/2;
+	id_map_clear(map);
+}
+
+void id_map_clear(Id_Map_t* map)
+{
+	memset(map->keys, 0xFF, sizeof(uint32_t)*(map->mask + 1));
+	map->max_probe = 0;
+	map->count = 0;
+}
+
+FAST_RUN uint16_t id_map_find(const Id_Map_t* map, uint32_t key)
+{
+	uint16_t slot = HASH(map, key);
+	for (uint16_t i = 0; i <= map->max_probe; i++)
+	{
+		uint32_t k = map->keys[slot];
+		if (k == key) return map->items[slot];
+		if (k == ID_MAP_EMPTY) break;
+		slot = (slot + 1) & map->mask;
+	}
+
+	return ID_MAP_NONE;
+}
+
+//at most limit keys, half full by default: linear probing stays short
+FAST_RUN uint8_t id_map_insert(Id_Map_t* map, uint32_t key, uint16_t item)
+{
+	if (map->count >= map->limit) return 0;
+
+	uint16_t slot = HASH(map, key);
+	for (uint16_t i = 0; i <= map->mask; i++)
+	{
+		if (map->keys[slot] == ID_MAP_EMPTY)
+		{
+			map->keys[slot] = key;
+			map->items[slot] = item;
+			map->count++;
+			if (i > map->max_probe) map->max_probe = i;
+			return 1;
+		}
+		slot = (slot + 1) & map->mask;
+	}
+
+	return 0;
+}
+
+//
+//Backward shift deletion: no tombstones, probe lengths only get shorter.
+//
+FAST_RUN uint16_t id_map_remove(Id_Map_t* map, uint32_t key)
+{
+	uint16_t slot = HASH(map, key);
+	uint16_t i;
+	for (i = 0; i <= map->max_probe; i++)
+	{
+		if (map->keys[slot] == key) break;
+		if (map->keys[slot] == ID_MAP_EMPTY) return ID_MAP_NONE;
+		slot = (slot + 1) & map->mask;
+	}
+	if (i > map->max_probe) return ID_MAP_NONE;
+
+	uint16_t item = map->items[slot];
+	uint16_t hole = slot;
+	uint16_t next = (slot + 1) & map->mask;
+	while (map->keys[next] != ID_MAP_EMPTY)
+	{
+		//move back anything whose home isn't cyclically in (hole, next]
+		uint16_t home = HASH(map, map->keys[next]);
+		if (((next - home) & map->mask) >= ((next - hole) & map->mask))
+		{
+			map->keys[hole] = map->keys[next];
+			map->items[hole] = map->items[next];
+			hole = next;
+		}
+		next = (next + 1) & map->mask;
+	}
+	map->keys[hole] = ID_MAP_EMPTY;
+	map->count--;
+
+	return item;
+}
@@ -0,0 +1,34 @@
+/*
+ * id_map.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef ID_MAP_H_
+#define ID_MAP_H_
+#include <stdint.h>
+
+#define ID_MAP_EMPTY		0xFFFFFFFF
+#define ID_MAP_NONE			0xFFFF
+#define ID_MAP_KEY(id, ide)	(((id) & 0x1FFFFFFF) | ((ide)?0x80000000:0))
+
+//! open addressing CAN ID -> item index, linear probing
+typedef struct
+{
+	uint32_t*	keys;
+	uint16_t*	items;
+	uint16_t	mask;			//slots - 1, slots is a power of 2
+	uint8_t		shift;			//32 - log2(slots)
+	uint16_t	max_probe;		//longest probe of a key in the map
+	uint16_t	count;
+	uint16_t	limit;			//most keys, half the slots unless the owner sets it
+}Id_Map_t;
+
+void id_map_init(Id_Map_t* map, uint32_t* keys, uint16_t* items, uint8_t bits);
+void id_map_clear(Id_Map_t* map);
+uint16_t id_map_find(const Id_Map_t* map, uint32_t key);
+uint8_t id_map_insert(Id_Map_t* map, uint32_t key, uint16_t item);
+uint16_t id_map_remove(Id_Map_t* map, uint32_t key);
+
+#endif /* ID_MAP_H_ */
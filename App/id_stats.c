@@ -0,0 +1,172 @@
+/*
+ * id_stats.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "id_stats.h"
+#include "id_map.h"
+#include "timebase.h"
+#include "board.h"
+#include <string.h>
+
+#define JITTER_SHIFT	4		//1/16 smoothing, as RFC 3550 interarrival jitter
+
+//! traffic of an ID
+typedef struct
+{
+	uint32_t	key;
+	uint32_t	count;
+	uint32_t	last;			//us
+	uint32_t	period;			//us, last one
+	uint32_t	min_period;
+	uint32_t	max_period;
+	uint64_t	sum_period;
+	uint32_t	jitter;			//us << JITTER_SHIFT
+	uint8_t		dlc_min;
+	uint8_t		dlc_max;
+	uint8_t		flags;			//CAN_FENTRY_RTR, CAN_FENTRY_ANY_RTR - both seen
+}Id_Stat_t;
+
+static uint32_t map_keys[1 << ID_STATS_BITS];
+static uint16_t map_items[1 << ID_STATS_BITS];
+static Id_Map_t map;
+
+static Id_Stat_t items[ID_STATS_ITEMS];
+static uint8_t mode = CAN_IDSTAT_OFF;
+static uint16_t hand = 0;
+static uint32_t evictions = 0;
+
+//
+//Private forwards
+//
+static uint16_t evict();
+
+//
+//Public members
+//
+void id_stats_init()
+{
+	id_map_init(&map, map_keys, map_items, ID_STATS_BITS);
+	id_stats_set_mode(CAN_IDSTAT_OFF);
+}
+
+//any mode change starts an empty table
+void id_stats_set_mode(uint8_t m)
+{
+	__disable_irq();
+	id_map_clear(&map);
+	mode = m;
+	hand = 0;
+	evictions = 0;
+	__enable_irq();
+}
+
+uint8_t id_stats_mode()
+{
+	return mode;
+}
+
+//
+//Called from the RX ISR, 1 - the frame still goes on.
+//
+FAST_RUN uint8_t id_stats_update(const CAN_USB_Mess_t* mess, uint32_t now)
+{
+	if (mode == CAN_IDSTAT_OFF) return 1;
+
+	uint32_t key = ID_MAP_KEY(mess->id, mess->flags.ide);
+	uint8_t rtr = mess->flags.rtr?CAN_FENTRY_RTR:0;
+	uint16_t item = id_map_find(&map, key);
+	if (item == ID_MAP_NONE)
+	{
+		item = (map.count < ID_STATS_ITEMS)?map.count:evict();
+		id_map_insert(&map, key, item);
+
+		Id_Stat_t* st = &items[item];
+		memset(st, 0, sizeof(Id_Stat_t));
+		st->key = key;
+		st->count = 1;
+		st->last = now;
+		st->min_period = 0xFFFFFFFF;
+		st->dlc_min = st->dlc_max = mess->flags.dlc;
+		st->flags = rtr;
+		return (mode == CAN_IDSTAT_ALSO);
+	}
+
+	Id_Stat_t* st = &items[item];
+	uint32_t period = now - st->last;
+	if (st->count > 1)
+	{
+		uint32_t d = (period > st->period)?(period - st->period):(st->period - period);
+		st->jitter += d - (st->jitter >> JITTER_SHIFT);
+	}
+	st->period = period;
+	if (period < st->min_period) st->min_period = period;
+	if (period > st->max_period) st->max_period = period;
+	st->sum_period += period;
+	st->last = now;
+	st->count++;
+
+	if (mess->flags.dlc < st->dlc_min) st->dlc_min = mess->flags.dlc;
+	if (mess->flags.dlc > st->dlc_max) st->dlc_max = mess->flags.dlc;
+	if ((st->flags & CAN_FENTRY_RTR) != rtr) st->flags |= CAN_FENTRY_ANY_RTR;
+
+	return (mode == CAN_IDSTAT_ALSO);
+}
+
+//
+//Copies up to max entries starting at cursor, returns the cursor to
+//continue with, 0 once the table is done.
+//
+uint16_t id_stats_read(uint16_t cursor, CAN_USB_IdStats_t* out, uint8_t max)
+{
+	uint32_t now = tb_us();
+	uint16_t count = map.count;
+
+	out->count = 0;
+	out->entries = count;
+	out->evictions = evictions;
+	while ((cursor < count) && (out->count < max))
+	{
+		Id_Stat_t st;
+		__disable_irq();
+		st = items[cursor];
+		__enable_irq();
+		cursor++;
+
+		CAN_USB_IdStat_t* e = &out->stats[out->count++];
+		e->id = st.key & 0x1FFFFFFF;
+		e->flags = ((st.key & 0x80000000)?CAN_FENTRY_IDE:0) | st.flags;
+		e->dlc_min = st.dlc_min;
+		e->dlc_max = st.dlc_max;
+		e->count = st.count;
+		e->mean_us = (st.count > 1)?(st.sum_period/(st.count - 1)):0;
+		e->min_us = (st.count > 1)?st.min_period:0;
+		e->max_us = st.max_period;
+		e->jitter_us = st.jitter >> JITTER_SHIFT;
+		e->age_us = now - st.last;
+	}
+
+	out->cursor = (cursor < count)?cursor:0;
+	return out->cursor;
+}
+
+//
+//Private members
+//
+
+//least counted of a few entries at the clock hand, the hot IDs stay
+static FAST_RUN uint16_t evict()
+{
+	uint16_t victim = hand;
+	for (uint8_t i = 0; i < ID_STATS_SAMPLE; i++)
+	{
+		uint16_t item = (hand + i) % ID_STATS_ITEMS;
+		if (items[item].count < items[victim].count) victim = item;
+	}
+	hand = (hand + ID_STATS_SAMPLE) % ID_STATS_ITEMS;
+
+	id_map_remove(&map, items[victim].key);
+	evictions++;
+	return victim;
+}
@@ -0,0 +1,23 @@
+/*
+ * id_stats.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef ID_STATS_H_
+#define ID_STATS_H_
+#include "proto.h"
+
+#define ID_STATS_BITS		8
+#define ID_STATS_ITEMS		((1 << ID_STATS_BITS)/2)
+#define ID_STATS_SAMPLE		4		//eviction candidates looked at per new ID
+#define ID_STATS_BATCH		((0xFF - sizeof(CAN_USB_IdStats_t))/sizeof(CAN_USB_IdStat_t))
+
+void id_stats_init();
+void id_stats_set_mode(uint8_t mode);
+uint8_t id_stats_mode();
+uint8_t id_stats_update(const CAN_USB_Mess_t* mess, uint32_t now);
+uint16_t id_stats_read(uint16_t cursor, CAN_USB_IdStats_t* out, uint8_t max);
+
+#endif /* ID_STATS_H_ */
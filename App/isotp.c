@@ -0,0 +1,528 @@
+/*
+ * isotp.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "isotp.h"
+#include "tx_sched.h"
+#include "id_map.h"
+#include "app.h"
+#include "timebase.h"
+#include "board.h"
+#include <string.h>
+
+#define PCI_SF				0x00
+#define PCI_FF				0x10
+#define PCI_CF				0x20
+#define PCI_FC				0x30
+
+#define FC_CTS				0
+#define FC_WAIT				1
+#define FC_OVFLW			2
+
+//! sender states, the TIM2 channel 4 interrupt runs FIRST and SEND
+enum
+{
+	TX_IDLE = 0,
+	TX_FIRST,						//SF or FF waits for a mailbox
+	TX_WAIT_FC,
+	TX_SEND							//consecutive frames, paced by STmin
+};
+
+//! receiver states, READY holds the PDU until the host has read it all
+enum
+{
+	RX_IDLE = 0,
+	RX_RECV,
+	RX_READY
+};
+
+//! PDU buffer user, requests and responses take turns as in UDS
+enum
+{
+	BUF_FREE = 0,
+	BUF_LOAD,						//upload started, not sent yet
+	BUF_TX,							//on the wire or sent, kept for a retry
+	BUF_RX							//being received or delivered
+};
+
+static CAN_USB_IsoTpConfig_t config;
+static uint32_t tx_key = 0;
+static uint32_t rx_key = 0;
+static uint8_t configured = 0;
+
+static uint8_t buf[ISOTP_PDU_MAX];
+static volatile uint8_t buf_user = BUF_FREE;
+
+static volatile uint8_t tx_state = TX_IDLE;
+static uint8_t tx_result = CAN_ISOTP_OK;
+static uint16_t tx_len = 0;
+static uint16_t tx_pos = 0;
+static uint8_t tx_sn = 0;
+static uint8_t tx_bs = 0;			//0 - no more FC until the end
+static uint8_t tx_bs_left = 0;
+static uint32_t tx_st = 0;			//us
+static uint32_t tx_due = 0;
+static uint32_t tx_since = 0;		//ms, FC wait start
+static uint8_t tx_waits = 0;
+static volatile uint8_t tx_changed = 0;
+
+static volatile uint8_t rx_state = RX_IDLE;
+static uint16_t rx_len = 0;
+static uint16_t rx_pos = 0;
+static uint16_t rx_read = 0;		//delivered to the host
+static uint8_t rx_sn = 0;
+static uint8_t rx_bs_left = 0;
+static uint32_t rx_since = 0;		//ms, last frame of the PDU
+static volatile uint8_t rx_fc = 0;	//FC_xxx + 1 still to be sent
+
+static uint32_t tx_pdus = 0;
+static uint32_t rx_pdus = 0;
+static uint32_t tx_errors = 0;
+static uint32_t rx_errors = 0;
+static uint32_t rx_overflows = 0;
+
+//
+//Private forwards
+//
+static void rx_frame(const CAN_USB_Mess_t* mess);
+static uint8_t rx_take();
+static uint8_t send_frame(const uint8_t* data, uint8_t len);
+static uint8_t send_fc(uint8_t fs);
+static void tx_done(uint8_t result);
+static uint32_t st_min_us(uint8_t st);
+static void arm(uint32_t us);
+
+//
+//Public members
+//
+void isotp_init()
+{
+	memset(&config, 0, sizeof(config));
+	configured = 0;
+	isotp_abort();
+	tx_result = CAN_ISOTP_OK;
+	tx_changed = 0;
+	tx_pdus = rx_pdus = tx_errors = rx_errors = rx_overflows = 0;
+}
+
+void isotp_abort()
+{
+	__disable_irq();
+	__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC4);
+	if (tx_state != TX_IDLE) tx_done(CAN_ISOTP_ABORTED);
+	rx_state = RX_IDLE;
+	rx_fc = 0;
+	buf_user = BUF_FREE;
+	__enable_irq();
+}
+
+uint8_t isotp_config(const CAN_USB_IsoTpConfig_t* cfg)
+{
+	isotp_abort();
+
+	uint8_t ide = cfg->flags & CAN_ISOTP_IDE;
+	config = *cfg;
+	tx_key = ID_MAP_KEY(cfg->tx_id, ide);
+	rx_key = ID_MAP_KEY(cfg->rx_id, ide);
+	configured = 1;
+	return 1;
+}
+
+//
+//Refused while a received PDU is in the buffer. The copy is done under
+//the lock and the buffer stays loading until isotp_send(), so a first
+//frame arriving between two pieces can't write into it.
+//
+uint8_t isotp_data(uint16_t offset, const uint8_t* data, uint16_t len)
+{
+	if (((uint32_t)offset + len) > sizeof(buf)) return 0;
+
+	__disable_irq();
+	uint8_t ok = (tx_state == TX_IDLE) && (buf_user != BUF_RX);
+	if (ok)
+	{
+		buf_user = BUF_LOAD;
+		memcpy(&buf[offset], data, len);
+	}
+	__enable_irq();
+	return ok;
+}
+
+//
+//The first frame goes out from the timer interrupt as everything else,
+//so a busy mailbox is retried there and the host call never waits.
+//Refused if a received PDU has taken the buffer since the last send.
+//
+uint8_t isotp_send(uint16_t len)
+{
+	if (!configured || !len || (len > ISOTP_PDU_MAX)) return 0;
+
+	__disable_irq();
+	if ((tx_state != TX_IDLE) || ((buf_user != BUF_LOAD) && (buf_user != BUF_TX)))
+	{
+		__enable_irq();
+		return 0;
+	}
+	buf_user = BUF_TX;
+	tx_len = len;
+	tx_pos = 0;
+	tx_sn = 1;
+	tx_waits = 0;
+	tx_result = CAN_ISOTP_BUSY;
+	tx_state = TX_FIRST;
+	tx_due = tb_us();
+	arm(0);
+	__enable_irq();
+	return 1;
+}
+
+uint8_t isotp_active()
+{
+	return (tx_state != TX_IDLE) || (rx_state == RX_RECV);
+}
+
+//
+//TIM2 channel 4: the first frame, then one consecutive frame per STmin.
+//A block ends with the wait for the next flow control from the receiver.
+//Runs from flash as the rest of the engine, STmin steps are 100 us.
+//
+void isotp_run()
+{
+	if ((tx_state != TX_FIRST) && (tx_state != TX_SEND))
+	{
+		__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC4);
+		return;
+	}
+
+	int32_t left = tx_due - tb_us();
+	if (left > 0)
+	{
+		arm(left);
+		return;
+	}
+
+	uint8_t frame[8];
+	uint8_t pci = 1;
+	uint8_t n;
+	if (tx_state == TX_FIRST)
+	{
+		if (tx_len <= 7)
+		{
+			frame[0] = PCI_SF | tx_len;
+			n = tx_len;
+		}
+		else
+		{
+			frame[0] = PCI_FF | (tx_len >> 8);
+			frame[1] = tx_len;
+			pci = 2;
+			n = 6;
+		}
+	}
+	else
+	{
+		frame[0] = PCI_CF | tx_sn;
+		n = ((tx_len - tx_pos) < 7)?(tx_len - tx_pos):7;
+	}
+	memcpy(&frame[pci], &buf[tx_pos], n);
+
+	if (!send_frame(frame, pci + n))
+	{
+		arm(TX_SCHED_RETRY);
+		return;
+	}
+
+	tx_pos += n;
+	if (tx_pos >= tx_len)
+	{
+		__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC4);
+		tx_done(CAN_ISOTP_OK);
+		return;
+	}
+
+	if (tx_state == TX_SEND)
+	{
+		tx_sn = (tx_sn + 1) & 0x0F;
+		if (!tx_bs || --tx_bs_left)
+		{
+			tx_due = tb_us() + tx_st;
+			arm(tx_st);
+			return;
+		}
+	}
+
+	__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC4);
+	tx_state = TX_WAIT_FC;
+	tx_since = HAL_GetTick();
+}
+
+//
+//Called from the RX ISRs for every frame the hardware filters let through,
+//only the ID check runs from RAM. Flow control is answered right here,
+//not through the host.
+//
+FAST_RUN void isotp_rx(const CAN_USB_Mess_t* mess)
+{
+	if (!configured || mess->flags.rtr || mess->flags.echo) return;
+	if (ID_MAP_KEY(mess->id, mess->flags.ide) != rx_key) return;
+	if (!mess->flags.dlc) return;
+
+	rx_frame(mess);
+}
+
+//
+//Main loop: N_Bs/N_Cr timeouts and a flow control that found no mailbox
+//
+void isotp_step(uint32_t tick)
+{
+	if (!configured) return;
+
+	__disable_irq();
+	if ((tx_state == TX_WAIT_FC) && ((tick - tx_since) > ISOTP_N_BS))
+		tx_done(CAN_ISOTP_TIMEOUT);
+	if ((rx_state == RX_RECV) && ((tick - rx_since) > ISOTP_N_CR))
+	{
+		rx_errors++;
+		rx_state = RX_IDLE;
+		buf_user = BUF_FREE;
+	}
+	if (rx_fc && send_fc(rx_fc - 1))
+		rx_fc = 0;
+	__enable_irq();
+}
+
+//
+//Next piece of a received PDU for the host, 0 - nothing to deliver.
+//The ISR leaves a READY buffer alone, so it is read without a lock.
+//
+uint8_t isotp_read(CAN_USB_IsoTpRx_t* out, uint8_t max)
+{
+	if (rx_state != RX_READY) return 0;
+
+	uint16_t n = rx_len - rx_read;
+	if (n > max) n = max;
+	out->op = CAN_ISOTP_RX;
+	out->total = rx_len;
+	out->offset = rx_read;
+	memcpy(out->data, &buf[rx_read], n);
+
+	rx_read += n;
+	if (rx_read >= rx_len)
+	{
+		__disable_irq();
+		rx_state = RX_IDLE;
+		buf_user = BUF_FREE;
+		__enable_irq();
+	}
+	return n;
+}
+
+//finished or failed transfer since the last call
+uint8_t isotp_changed()
+{
+	if (!tx_changed) return 0;
+	tx_changed = 0;
+	return 1;
+}
+
+void isotp_stat(CAN_USB_IsoTpStat_t* out)
+{
+	out->op = CAN_ISOTP_STAT;
+	out->tx_result = tx_result;
+	out->tx_len = tx_len;
+	out->tx_pos = tx_pos;
+	out->rx_state = rx_state;
+	out->rx_pos = rx_pos;
+	out->tx_pdus = tx_pdus;
+	out->rx_pdus = rx_pdus;
+	out->tx_errors = tx_errors;
+	out->rx_errors = rx_errors;
+	out->rx_overflows = rx_overflows;
+}
+
+//
+//Private members
+//
+
+//PCI dispatch of a frame for rx_id
+static FLASH_RUN void rx_frame(const CAN_USB_Mess_t* mess)
+{
+	const uint8_t* d = mess->data;
+	uint8_t dlc = (mess->flags.dlc > 8)?8:mess->flags.dlc;
+	switch(d[0] & 0xF0)
+	{
+		case PCI_SF:
+		{
+			uint8_t len = d[0] & 0x0F;
+			if (!len || (len >= dlc)) return;
+			if (!rx_take())
+			{
+				rx_overflows++;
+				return;
+			}
+
+			memcpy(buf, &d[1], len);
+			rx_len = len;
+			rx_read = 0;
+			rx_state = RX_READY;
+			rx_pdus++;
+			break;
+		}
+		case PCI_FF:
+		{
+			uint16_t len = ((d[0] & 0x0F) << 8) | d[1];
+			if ((len < 8) || (dlc < 8)) return;
+			if ((len > ISOTP_PDU_MAX) || !rx_take())
+			{
+				rx_overflows++;
+				if (!send_fc(FC_OVFLW)) rx_fc = FC_OVFLW + 1;
+				return;
+			}
+
+			memcpy(buf, &d[2], 6);
+			rx_len = len;
+			rx_pos = 6;
+			rx_sn = 1;
+			rx_bs_left = config.block_size;
+			rx_since = HAL_GetTick();
+			rx_state = RX_RECV;
+			if (!send_fc(FC_CTS)) rx_fc = FC_CTS + 1;
+			break;
+		}
+		case PCI_CF:
+		{
+			if (rx_state != RX_RECV) return;
+			if ((d[0] & 0x0F) != rx_sn)
+			{
+				rx_errors++;
+				rx_state = RX_IDLE;
+				buf_user = BUF_FREE;
+				return;
+			}
+
+			uint8_t n = ((rx_len - rx_pos) < 7)?(rx_len - rx_pos):7;
+			if (n >= dlc)
+			{
+				rx_errors++;
+				rx_state = RX_IDLE;
+				buf_user = BUF_FREE;
+				return;
+			}
+			memcpy(&buf[rx_pos], &d[1], n);
+			rx_pos += n;
+			rx_sn = (rx_sn + 1) & 0x0F;
+			rx_since = HAL_GetTick();
+
+			if (rx_pos >= rx_len)
+			{
+				rx_read = 0;
+				rx_state = RX_READY;
+				rx_pdus++;
+			}
+			else if (config.block_size && !--rx_bs_left)
+			{
+				rx_bs_left = config.block_size;
+				if (!send_fc(FC_CTS)) rx_fc = FC_CTS + 1;
+			}
+			break;
+		}
+		case PCI_FC:
+		{
+			if (tx_state != TX_WAIT_FC) return;
+			if (dlc < 3)
+			{
+				tx_done(CAN_ISOTP_BAD_FC);
+				return;
+			}
+
+			switch(d[0] & 0x0F)
+			{
+				case FC_CTS:
+					tx_bs = d[1];
+					tx_bs_left = tx_bs;
+					tx_st = st_min_us(d[2]);
+					tx_waits = 0;
+					tx_due = tb_us();
+					tx_state = TX_SEND;
+					arm(0);
+					break;
+				case FC_WAIT:
+					tx_since = HAL_GetTick();
+					if (++tx_waits > ISOTP_WFT_MAX) tx_done(CAN_ISOTP_WAIT_MAX);
+					break;
+				case FC_OVFLW:
+					tx_done(CAN_ISOTP_OVERFLOW);
+					break;
+				default:
+					tx_done(CAN_ISOTP_BAD_FC);
+					break;
+			}
+			break;
+		}
+	}
+}
+
+//
+//SF or FF: the buffer goes to the receiver unless an upload or a
+//transmission is in progress or the last PDU isn't read yet. A sent PDU
+//kept for a retry is dropped, one still being received is restarted
+//(counted as an error).
+//
+static uint8_t rx_take()
+{
+	if ((tx_state != TX_IDLE) || (buf_user == BUF_LOAD) || (rx_state == RX_READY)) return 0;
+	if (rx_state == RX_RECV) rx_errors++;
+	buf_user = BUF_RX;
+	return 1;
+}
+
+static uint8_t send_frame(const uint8_t* data, uint8_t len)
+{
+	CAN_USB_Mess_t mess;
+	memset(&mess, 0, sizeof(mess));
+	mess.id = config.tx_id;
+	mess.flags.ide = (config.flags & CAN_ISOTP_IDE)?1:0;
+	memcpy(mess.data, data, len);
+	if (config.flags & CAN_ISOTP_PAD)
+	{
+		memset(&mess.data[len], config.pad, 8 - len);
+		len = 8;
+	}
+	mess.flags.dlc = len;
+
+	return app_can_send(&mess, 0);
+}
+
+static uint8_t send_fc(uint8_t fs)
+{
+	uint8_t fc[3] = {PCI_FC | fs, config.block_size, config.st_min};
+	return send_frame(fc, 3);
+}
+
+static void tx_done(uint8_t result)
+{
+	tx_state = TX_IDLE;
+	tx_result = result;
+	tx_changed = 1;
+	if (result == CAN_ISOTP_OK) tx_pdus++;
+	else tx_errors++;
+}
+
+//ISO 15765-2: 0..127 ms, 0xF1..0xF9 100..900 us, the rest is read as 127 ms
+static uint32_t st_min_us(uint8_t st)
+{
+	if (st <= 0x7F) return st*1000;
+	if ((st >= 0xF1) && (st <= 0xF9)) return (st - 0xF0)*100;
+	return 127000;
+}
+
+static void arm(uint32_t us)
+{
+	if (us > TX_SCHED_MAX_WAIT) us = TX_SCHED_MAX_WAIT;
+	if (us < 2) us = 2;
+	__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_4, (__HAL_TIM_GET_COUNTER(&htim2) + us) & 0xFFFF);
+	__HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_CC4);
+	__HAL_TIM_ENABLE_IT(&htim2, TIM_IT_CC4);
+}
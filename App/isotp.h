@@ -0,0 +1,30 @@
+/*
+ * isotp.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef ISOTP_H_
+#define ISOTP_H_
+#include "proto.h"
+
+#define ISOTP_PDU_MAX		4095	//FF length limit, one half duplex buffer
+#define ISOTP_N_BS			1000	//ms, flow control wait on TX
+#define ISOTP_N_CR			1000	//ms, consecutive frame wait on RX
+#define ISOTP_WFT_MAX		16		//FC WAIT in a row before giving up
+
+void isotp_init();
+void isotp_abort();
+uint8_t isotp_config(const CAN_USB_IsoTpConfig_t* cfg);
+uint8_t isotp_data(uint16_t offset, const uint8_t* data, uint16_t len);
+uint8_t isotp_send(uint16_t len);
+uint8_t isotp_active();
+void isotp_run();
+void isotp_rx(const CAN_USB_Mess_t* mess);
+void isotp_step(uint32_t tick);
+uint8_t isotp_read(CAN_USB_IsoTpRx_t* out, uint8_t max);
+uint8_t isotp_changed();
+void isotp_stat(CAN_USB_IsoTpStat_t* out);
+
+#endif /* ISOTP_H_ */
@@ -0,0 +1,71 @@
+/*
+ * latency.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "latency.h"
+#include "board.h"
+#include <string.h>
+
+//
+//Private forwards
+//
+static uint8_t bucket(uint32_t us);
+static uint32_t bucket_top(uint8_t b);
+
+//
+//Public members
+//
+void latency_reset(Latency_t* lat)
+{
+	memset(lat, 0, sizeof(Latency_t));
+}
+
+FAST_RUN void latency_add(Latency_t* lat, uint32_t us)
+{
+	lat->hist[bucket(us)]++;
+	lat->count++;
+	if (us > lat->max) lat->max = us;
+}
+
+//upper edge of the bucket holding the sample, never above the real max.
+//The top bucket has no upper edge, it reports the max.
+uint32_t latency_percentile(const Latency_t* lat, uint16_t permille)
+{
+	if (!lat->count) return 0;
+
+	uint32_t rank = ((uint64_t)lat->count*permille + 999)/1000;
+	uint32_t seen = 0;
+	for (uint8_t b = 0; b < LATENCY_BUCKETS; b++)
+	{
+		seen += lat->hist[b];
+		if (seen >= rank)
+		{
+			uint32_t top = (b < (LATENCY_BUCKETS - 1))?bucket_top(b):lat->max;
+			return (top < lat->max)?top:lat->max;
+		}
+	}
+
+	return lat->max;
+}
+
+//
+//Private members
+//
+
+//0..3 as is, then the top bit picks the octave and the next two the sub-bucket
+static FAST_RUN uint8_t bucket(uint32_t us)
+{
+	if (us < 4) return us;
+	uint8_t msb = 31 - __builtin_clz(us);
+	if (msb >= LATENCY_MAX_BIT) return LATENCY_BUCKETS - 1;
+	return (msb - 1)*4 + ((us >> (msb - 2)) & 3);
+}
+
+static uint32_t bucket_top(uint8_t b)
+{
+	if (b < 4) return b;
+	uint8_t msb = b/4 + 1;
+	return ((4U + (b & 3)) << (msb - 2)) + (1U << (msb - 2)) - 1;
+}
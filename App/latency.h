@@ -0,0 +1,27 @@
+/*
+ * latency.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+#include <stdint.h>
+
+#define LATENCY_MAX_BIT		17		//~130 ms, longer samples land in the top bucket
+#define LATENCY_BUCKETS		(4*LATENCY_MAX_BIT)
+
+//! log histogram with 4 sub-buckets per octave, within 25% of the true value
+typedef struct
+{
+	uint32_t	hist[LATENCY_BUCKETS];
+	uint32_t	count;
+	uint32_t	max;
+}Latency_t;
+
+void latency_reset(Latency_t* lat);
+void latency_add(Latency_t* lat, uint32_t us);
+uint32_t latency_percentile(const Latency_t* lat, uint16_t permille);
+
+#endif /* LATENCY_H_ */
@@ -11,6 +11,8 @@
 
 #define _PREFIX_		0xF0
 
+#define CAN_FILTER_BANKS	28
+
 
 #pragma pack(1)
 
@@ -28,6 +30,7 @@ typedef struct
 	uint8_t		dlc : 4;
 	uint8_t		ide : 1;
 	uint8_t		rtr : 1;
+	uint8_t		echo : 1;	//self-received in loopback modes
 }CAN_USB_Flags_t;
 
 //! message payload
@@ -39,6 +42,13 @@ typedef struct
 	uint8_t			data[8];
 }CAN_USB_Mess_t;
 
+//! CAN_PT_MESS packet exactly as it goes over USB
+typedef struct
+{
+	CAN_USB_Header_t	hdr;
+	CAN_USB_Mess_t		mess;
+}CAN_USB_MessPck_t;
+
 
 
 //! filter payload
@@ -56,6 +66,486 @@ typedef struct
 	uint32_t SlaveStartFilterBank;
 } CAN_USB_Filter_t;
 
+//! filter list entry, mask bits set to 1 must match (exact id: all ones)
+typedef struct
+{
+	uint32_t	id;
+	uint32_t	mask;
+	uint8_t		flags;				//CAN_FENTRY_xxx
+}CAN_USB_FilterEntry_t;
+
+//! filter list payload: op followed by entries for CAN_FLIST_ADD
+typedef struct
+{
+	uint8_t		op;					//CAN_FLIST_xxx
+	CAN_USB_FilterEntry_t	entries[];
+}CAN_USB_FilterListCmd_t;
+
+//! filter list reply
+typedef struct
+{
+	uint8_t		result;				//1 - last apply succeeded
+	uint16_t	entries;			//entries uploaded
+	uint8_t		banks;				//banks used by the last apply
+	uint16_t	finit_us;			//filter init mode blind time of the last apply
+	uint32_t	false_accepts;		//IDs accepted beyond the requested set (overlaps not counted)
+	uint8_t		layout[CAN_FILTER_BANKS];	//CAN_FLAYOUT_xxx
+	uint16_t	sw_rejected;		//entries the software acceptance set couldn't hold, the list isn't applied
+}CAN_USB_FilterList_t;
+
+//! rx policy entry
+typedef struct
+{
+	uint32_t	id;
+	uint8_t		flags;				//CAN_FENTRY_IDE, CAN_RXPF_xxx
+	uint16_t	every_n;			//forward every Nth frame, 0/1 - all
+	uint32_t	min_interval_us;	//forward at most once per interval, 0 - no limit
+	uint32_t	id_mask;			//not all ones - the entry is a range template for every matching ID
+	uint8_t		data_mask[8];		//CAN_RXPF_ON_CHANGE: bytes compared with the last forwarded payload
+	uint32_t	heartbeat_us;		//CAN_RXPF_ON_CHANGE: forward unchanged payload after this, 0 - never
+}CAN_USB_RxPolicy_t;
+
+//! rx policy payload: op followed by entries for CAN_RXP_SET/CAN_RXP_REMOVE
+typedef struct
+{
+	uint8_t		op;					//CAN_RXP_xxx
+	CAN_USB_RxPolicy_t	entries[];
+}CAN_USB_RxPolicyCmd_t;
+
+//! rx policy reply
+typedef struct
+{
+	uint16_t	entries;
+	uint16_t	capacity;
+	uint32_t	matched;			//frames which hit a policy
+	uint32_t	suppressed;
+	uint32_t	bytes_saved;		//USB bytes not sent because of suppression
+	uint16_t	ranges;
+	uint32_t	unchanged;			//suppressed by CAN_RXPF_ON_CHANGE
+	uint32_t	untracked;			//range hits without a free entry, forwarded
+}CAN_USB_RxPolicyStat_t;
+
+//! payload filter rule: frames of a covered ID pass if data[offset..] & mask == value
+typedef struct
+{
+	uint32_t	id;
+	uint32_t	id_mask;			//bits set to 1 must match
+	uint8_t		flags;				//CAN_FENTRY_IDE
+	uint8_t		offset;				//first payload byte compared
+	uint32_t	value;				//data[offset] is the low byte
+	uint32_t	mask;
+}CAN_USB_DataRule_t;
+
+//! payload filter payload: op followed by rules for CAN_DFILT_ADD
+typedef struct
+{
+	uint8_t		op;					//CAN_DFILT_xxx
+	CAN_USB_DataRule_t	rules[];
+}CAN_USB_DataFilterCmd_t;
+
+//! payload filter reply
+typedef struct
+{
+	uint8_t		rules;
+	uint8_t		capacity;
+	uint32_t	dropped;
+}CAN_USB_DataFilterStat_t;
+
+//! congestion policy, watermarks in RX ring frames
+typedef struct
+{
+	uint8_t		flags;				//CAN_CONG_xxx
+	uint16_t	high;				//congested from this fill
+	uint16_t	low;				//back to normal at this fill
+	uint32_t	prio_id;			//CAN_CONG_DROP: frames losing arbitration to this ID are dropped
+}CAN_USB_Congestion_t;
+
+//! congestion reply
+typedef struct
+{
+	CAN_USB_Congestion_t	config;
+	uint8_t		congested;
+	uint16_t	fill;				//RX ring fill at the last frame
+	uint16_t	max_fill;
+	uint32_t	episodes;			//times the high watermark was crossed
+	uint32_t	dropped;			//CAN_CONG_DROP
+	uint32_t	conflated;			//CAN_CONG_CONFLATE: pending frames replaced by a newer one
+}CAN_USB_CongestionStat_t;
+
+//! snapshot request, an empty payload reads everything
+typedef struct
+{
+	uint32_t	since;				//gen of the last complete scan, 0 - everything
+	uint16_t	cursor;				//0 starts a scan, else the cursor of the last reply
+}CAN_USB_SnapshotReq_t;
+
+//! snapshot entry
+typedef struct
+{
+	CAN_USB_Mess_t	mess;			//latest frame of the ID
+	uint32_t	time_us;			//when it was received
+	uint32_t	count;				//frames of the ID since the mode was set
+}CAN_USB_SnapEntry_t;
+
+//! snapshot reply, one request gets as many as fit in the USB buffer
+typedef struct
+{
+	uint32_t	gen;				//since for the next scan
+	uint32_t	now_us;				//device time, for entry ages
+	uint16_t	cursor;				//0 - scan complete, else request again with it
+	uint8_t		count;
+	uint32_t	untracked;			//frames of IDs which didn't fit in the table
+	CAN_USB_SnapEntry_t	entries[];
+}CAN_USB_Snapshot_t;
+
+//! per ID statistics entry
+typedef struct
+{
+	uint32_t	id;
+	uint8_t		flags;				//CAN_FENTRY_xxx: IDE, RTR - remote seen, ANY_RTR - both seen
+	uint8_t		dlc_min;
+	uint8_t		dlc_max;
+	uint32_t	count;
+	uint32_t	mean_us;			//period
+	uint32_t	min_us;
+	uint32_t	max_us;
+	uint32_t	jitter_us;			//smoothed period to period change
+	uint32_t	age_us;				//since the last frame
+}CAN_USB_IdStat_t;
+
+//! per ID statistics reply, request payload: uint16_t cursor (0 or omitted - from the start)
+typedef struct
+{
+	uint16_t	cursor;				//0 - dump complete, else request again with it
+	uint8_t		count;
+	uint16_t	entries;			//IDs in the table
+	uint32_t	evictions;			//IDs dropped to make room for new ones
+	CAN_USB_IdStat_t	stats[];
+}CAN_USB_IdStats_t;
+
+//! signal layout entry
+typedef struct
+{
+	uint32_t	id;
+	uint8_t		flags;				//CAN_FENTRY_IDE, CAN_SIGF_xxx
+	uint8_t		start;				//DBC start bit
+	uint8_t		length;				//1..32
+}CAN_USB_Signal_t;
+
+//! signal layout payload: op followed by signals for CAN_SIG_ADD
+typedef struct
+{
+	uint8_t		op;					//CAN_SIG_xxx
+	CAN_USB_Signal_t	signals[];
+}CAN_USB_SignalCmd_t;
+
+//! CAN_PT_SIGNAL_DATA record, followed by the values of every signal of
+//! the ID in upload order, (length + 7)/8 bytes each, little endian
+typedef struct
+{
+	uint8_t		index;				//upload index of the first signal of the ID
+	uint32_t	time_us;
+}CAN_USB_SignalRec_t;
+
+//! signal layout reply
+typedef struct
+{
+	uint8_t		signals;
+	uint8_t		ids;
+	uint8_t		capacity;
+	uint32_t	records;
+	uint32_t	bytes_saved;		//against forwarding the frames
+}CAN_USB_SignalStat_t;
+
+//! periodic TX slot, CAN_PERIODIC_CLEAR needs the op only
+typedef struct
+{
+	uint8_t		op;					//CAN_PERIODIC_xxx
+	uint8_t		slot;
+	uint32_t	period_us;
+	uint32_t	phase_us;			//offset within the period from the CAN_PERIODIC_CLEAR time
+	CAN_USB_Mess_t	mess;
+}CAN_USB_Periodic_t;
+
+//! periodic TX reply
+typedef struct
+{
+	uint8_t		active;
+	uint8_t		capacity;
+	uint32_t	sent;
+	uint32_t	deferred;			//due with no free mailbox, retried
+	uint32_t	skipped;			//whole periods lost
+	uint32_t	late_max_us;		//due time to mailbox request, since the previous request
+}CAN_USB_PeriodicStat_t;
+
+//! frame with a deadline on the device clock, see CAN_USB_TimedStat_t::now_us
+typedef struct
+{
+	uint32_t		time_us;
+	CAN_USB_Mess_t	mess;
+}CAN_USB_Timed_t;
+
+//! timed TX payload: op followed by frames in deadline order for CAN_TIMED_ADD
+typedef struct
+{
+	uint8_t		op;					//CAN_TIMED_xxx
+	CAN_USB_Timed_t	frames[];
+}CAN_USB_TimedCmd_t;
+
+//! timed TX reply, also sent unsolicited when the queue drains to half
+typedef struct
+{
+	uint32_t	now_us;				//device clock when the reply was made
+	uint16_t	free;
+	uint16_t	queued;
+	uint32_t	sent;
+	uint32_t	late;				//mailbox requested more than TX_TIMED_LATE us after the deadline
+	uint32_t	late_max_us;		//since the previous reply
+	uint32_t	dropped;			//no room in the queue
+}CAN_USB_TimedStat_t;
+
+//! time-triggered setup, CAN_TT_STOP and CAN_TT_START need the op only
+typedef struct
+{
+	uint8_t		op;					//CAN_TT_xxx
+	uint8_t		flags;				//CAN_TTF_xxx
+	uint32_t	ref_id;
+	uint32_t	cycle_us;			//basic cycle
+	uint16_t	window_us;			//allowed slot SOF deviation, also the reference timeout
+	uint8_t		cycles;				//basic cycles per matrix, power of 2 up to 64
+}CAN_USB_TtConfig_t;
+
+//! time-triggered slot, repeat 0 frees it
+typedef struct
+{
+	uint8_t		op;					//CAN_TT_SLOT
+	uint8_t		slot;
+	uint32_t	offset_us;			//from the reference message SOF
+	uint8_t		base;				//first basic cycle
+	uint8_t		repeat;				//every Nth basic cycle, power of 2
+	CAN_USB_Mess_t	mess;
+}CAN_USB_TtSlot_t;
+
+//! time-triggered reply
+typedef struct
+{
+	uint8_t		state;				//CAN_TTS_xxx
+	uint8_t		slots;
+	uint8_t		cycle;				//current basic cycle
+	uint32_t	cycles;
+	uint32_t	misses;				//slots not sent or outside their window
+	uint32_t	ref_missed;			//reference timeouts, the cycle then runs on the local clock
+	uint16_t	max_err_us;			//worst slot SOF deviation from the TTCM timestamps, since the previous request
+}CAN_USB_TtStat_t;
+
+//! auto-responder entry, a matching frame is answered from the RX interrupt
+typedef struct
+{
+	uint8_t		op;					//CAN_RESP_xxx
+	uint8_t		index;
+	uint32_t	id;
+	uint32_t	id_mask;			//bits set to 1 must match
+	uint8_t		flags;				//CAN_FENTRY_IDE, CAN_FENTRY_RTR, CAN_FENTRY_ANY_RTR
+	uint8_t		data_value[8];		//request payload predicate
+	uint8_t		data_mask[8];
+	CAN_USB_Mess_t	response;
+}CAN_USB_Responder_t;
+
+//! auto-responder reply
+typedef struct
+{
+	uint8_t		entries;
+	uint8_t		capacity;
+	uint32_t	sent;
+	uint32_t	busy;				//matched with no free mailbox, not answered
+	uint32_t	hits[16];			//per entry, since it was set
+}CAN_USB_ResponderStat_t;
+
+//! rule VM code upload, len is the packet payload minus this header
+typedef struct
+{
+	uint8_t		op;					//CAN_VM_LOAD
+	uint16_t	offset;
+	uint8_t		code[];				//4 byte instructions: op, a, b, c
+}CAN_USB_VmLoad_t;
+
+//! rule VM start, the loaded code is verified first
+typedef struct
+{
+	uint8_t		op;					//CAN_VM_START
+	uint16_t	size;				//bytes
+	uint16_t	budget;				//instructions per frame, 0 - the maximum
+	uint32_t	regs[8];			//initial register values
+}CAN_USB_VmStart_t;
+
+//! rule VM reply
+typedef struct
+{
+	uint8_t		state;				//1 - running
+	uint8_t		error;				//CAN_VME_xxx of the last start
+	uint16_t	error_pc;			//instruction that failed the check
+	uint16_t	size;
+	uint16_t	worst_steps;		//longest path found by the verifier
+	uint16_t	budget;
+	uint32_t	runs;
+	uint32_t	sent;
+	uint32_t	busy;				//no free mailbox, not sent
+	uint32_t	aborted;			//budget or opcode trap, expected to stay 0
+	uint32_t	regs[8];
+}CAN_USB_VmStat_t;
+
+//! E2E protected ID
+typedef struct
+{
+	uint8_t		op;					//CAN_E2E_xxx
+	uint8_t		index;
+	uint32_t	id;
+	uint8_t		flags;				//CAN_E2E_IDE, CAN_E2E_TX, ...
+	uint16_t	data_id;			//fed to the CRC ahead of the payload
+	uint8_t		crc_byte;
+	uint8_t		counter_byte;
+	uint8_t		counter_shift;		//counter field LSB in counter_byte
+	uint8_t		counter_max;		//14 for profile 1, 15 for profile 2
+	uint8_t		max_delta;			//counter step still accepted on RX, 0 - 1
+}CAN_USB_E2e_t;
+
+//! E2E per-ID counters
+typedef struct
+{
+	uint8_t		counter;			//next TX or last RX value, 0xFF - none yet
+	uint16_t	crc_errors;
+	uint16_t	seq_errors;
+}CAN_USB_E2eEntryStat_t;
+
+//! E2E reply
+typedef struct
+{
+	uint8_t		entries;
+	uint8_t		capacity;
+	uint32_t	tx_filled;
+	uint32_t	rx_ok;
+	uint32_t	rx_crc;
+	uint32_t	rx_repeated;
+	uint32_t	rx_lost;			//counter jumps above max_delta or out of range
+	CAN_USB_E2eEntryStat_t	entry[16];
+}CAN_USB_E2eStat_t;
+
+//! ISO-TP channel, normal addressing
+typedef struct
+{
+	uint8_t		op;					//CAN_ISOTP_CONFIG
+	uint8_t		flags;				//CAN_ISOTP_IDE, CAN_ISOTP_PAD
+	uint32_t	tx_id;
+	uint32_t	rx_id;
+	uint8_t		block_size;			//sent in our flow control, 0 - no limit
+	uint8_t		st_min;				//same, ISO 15765-2 encoding
+	uint8_t		pad;				//filler byte with CAN_ISOTP_PAD
+}CAN_USB_IsoTpConfig_t;
+
+//! ISO-TP PDU upload, len is the packet payload minus this header.
+//! TX and RX share one buffer: refused while a received PDU is pending,
+//! a PDU arriving between the first piece and CAN_ISOTP_SEND is refused.
+typedef struct
+{
+	uint8_t		op;					//CAN_ISOTP_DATA
+	uint16_t	offset;
+	uint8_t		data[];
+}CAN_USB_IsoTpData_t;
+
+//! ISO-TP transmission of the uploaded PDU
+typedef struct
+{
+	uint8_t		op;					//CAN_ISOTP_SEND
+	uint16_t	len;
+}CAN_USB_IsoTpSend_t;
+
+//! ISO-TP received PDU piece, sent unsolicited in offset order
+typedef struct
+{
+	uint8_t		op;					//CAN_ISOTP_RX
+	uint16_t	total;
+	uint16_t	offset;
+	uint8_t		data[];
+}CAN_USB_IsoTpRx_t;
+
+//! ISO-TP reply, also sent unsolicited when a transmission ends
+typedef struct
+{
+	uint8_t		op;					//CAN_ISOTP_STAT
+	uint8_t		tx_result;			//CAN_ISOTP_OK, CAN_ISOTP_BUSY, ...
+	uint16_t	tx_len;
+	uint16_t	tx_pos;
+	uint8_t		rx_state;			//0 - idle, 1 - receiving, 2 - delivering to the host
+	uint16_t	rx_pos;
+	uint32_t	tx_pdus;
+	uint32_t	rx_pdus;
+	uint32_t	tx_errors;
+	uint32_t	rx_errors;			//sequence, timeout or interrupted
+	uint32_t	rx_overflows;		//PDUs refused: previous one not read, an upload or transmission or over ISOTP_PDU_MAX
+}CAN_USB_IsoTpStat_t;
+
+//! baud payload (mode is optional, CAN_OPMODE_NORMAL if omitted)
+typedef struct
+{
+	uint8_t		baud;
+	uint8_t		mode;
+}CAN_USB_Baud_t;
+
+//! status payload
+typedef struct
+{
+	uint8_t		baud;
+	uint8_t		mode;
+	uint16_t	reconf_us;			//blind window of the last bitrate/mode change
+	uint16_t	reconf_max_us;
+	uint32_t	rx_overruns;
+	uint8_t		tec;
+	uint8_t		rec;
+	uint8_t		estate;				//CAN_ESTATE_xxx
+	uint16_t	busoff_count;
+	uint32_t	error_frames;
+	uint32_t	fifo_overruns;		//hardware FIFO0/FIFO1 overruns
+	uint16_t	load_permille;		//bus load over the last CAN_OPT_LOAD_WINDOW
+	uint16_t	peak_load_permille;	//busiest 10 ms slice of that window
+	uint32_t	frames_per_s;
+	uint32_t	peak_frames_per_s;	//busiest 10 ms slice of that window
+	uint32_t	errors_per_s;
+	uint32_t	sw_rejected;		//dropped by the software acceptance stage
+	uint32_t	pack_saved;			//USB bytes saved by CAN_OPT_PACK
+	uint32_t	prio_frames;		//received on the CAN_FENTRY_PRIO lane (FIFO1)
+	uint32_t	prio_overruns;
+	uint32_t	bulk_p99_us;		//ISR to USB latency since the previous status
+	uint32_t	prio_p99_us;
+	uint16_t	rx_poll_permille;	//time FIFO0 was polled instead of interrupt driven, since the previous status
+	uint16_t	rx_cpu_permille;	//CPU spent receiving FIFO0 frames, same period
+	uint32_t	rx_poll_entries;	//switches to polling
+	uint32_t	tx_direct;			//frames put into a mailbox straight from the USB callback
+	uint32_t	tx_p50_us;			//USB reception to frame sent, since the previous status
+	uint32_t	tx_p99_us;
+	uint32_t	tx_max_us;
+	uint32_t	tt_cycles;			//time-triggered basic cycles
+	uint32_t	tt_misses;			//time-triggered slots missed
+	uint32_t	e2e_errors;			//E2E CRC and counter violations on RX
+}CAN_USB_Status_t;
+
+//! error payload
+typedef struct
+{
+	uint32_t	code;				//HAL_CAN_ERROR_xxx bits
+	uint8_t		lec;				//CAN_LEC_xxx
+	uint8_t		estate;				//CAN_ESTATE_xxx
+	uint8_t		tec;
+	uint8_t		rec;
+	uint16_t	count;				//events merged into this report
+}CAN_USB_Error_t;
+
+//! option payload, datalen 1 reads the option back
+typedef struct
+{
+	uint8_t		option;
+	uint32_t	value;
+}CAN_USB_Option_t;
+
 #pragma pack()
 
 //! baud rates
@@ -78,6 +568,308 @@ enum
 	CAN_BAUD_END
 };
 
+//! operating modes
+enum
+{
+	CAN_OPMODE_NORMAL = 0,
+	CAN_OPMODE_SILENT,				//listen only, never drives the bus
+	CAN_OPMODE_LOOPBACK,			//TX looped to RX internally, still driven to the bus
+	CAN_OPMODE_SILENT_LOOPBACK,		//TX looped to RX internally, bus untouched
+
+	CAN_OPMODE_END
+};
+
+//! filter list entry flags
+enum
+{
+	CAN_FENTRY_IDE = 0x01,
+	CAN_FENTRY_RTR = 0x02,			//match remote frames
+	CAN_FENTRY_ANY_RTR = 0x04,		//match both data and remote frames
+	CAN_FENTRY_PRIO = 0x08			//FIFO1 high priority lane, sent ahead of everything else
+};
+
+//! filter list ops
+enum
+{
+	CAN_FLIST_CLEAR = 0,
+	CAN_FLIST_ADD,
+	CAN_FLIST_APPLY
+};
+
+//! rx policy ops
+enum
+{
+	CAN_RXP_CLEAR = 0,
+	CAN_RXP_SET,
+	CAN_RXP_REMOVE
+};
+
+//! payload filter ops
+enum
+{
+	CAN_DFILT_CLEAR = 0,
+	CAN_DFILT_ADD
+};
+
+//! congestion flags
+enum
+{
+	CAN_CONG_DROP = 0x01,			//drop frames of lower priority than prio_id
+	CAN_CONG_CONFLATE = 0x02,		//keep only the newest pending frame per ID
+	CAN_CONG_PRIO_IDE = 0x04		//prio_id is extended
+};
+
+//! snapshot modes
+enum
+{
+	CAN_SNAP_OFF = 0,
+	CAN_SNAP_ONLY,					//frames only update the table
+	CAN_SNAP_ALSO,					//frames update the table and are streamed
+	CAN_SNAP_END
+};
+
+//! per ID statistics modes
+enum
+{
+	CAN_IDSTAT_OFF = 0,
+	CAN_IDSTAT_ONLY,				//frames are only counted, nothing is forwarded
+	CAN_IDSTAT_ALSO,				//frames are counted and go on
+	CAN_IDSTAT_END
+};
+
+//! signal layout ops
+enum
+{
+	CAN_SIG_CLEAR = 0,
+	CAN_SIG_ADD
+};
+
+//! periodic TX ops
+enum
+{
+	CAN_PERIODIC_CLEAR = 0,			//stop all slots, restart the phase reference
+	CAN_PERIODIC_SET,				//start or restart a slot
+	CAN_PERIODIC_DATA,				//replace dlc and data of a running slot, timing is kept
+	CAN_PERIODIC_STOP
+};
+
+//! timed TX ops
+enum
+{
+	CAN_TIMED_FLUSH = 0,
+	CAN_TIMED_ADD
+};
+
+//! time-triggered ops
+enum
+{
+	CAN_TT_STOP = 0,
+	CAN_TT_CONFIG,					//CAN_USB_TtConfig_t, clears the slots
+	CAN_TT_SLOT,					//CAN_USB_TtSlot_t
+	CAN_TT_START
+};
+
+//! time-triggered flags
+enum
+{
+	CAN_TTF_REF_IDE = 0x01,
+	CAN_TTF_MASTER = 0x10			//send the reference message, otherwise follow it
+};
+
+//! time-triggered states
+enum
+{
+	CAN_TTS_OFF = 0,
+	CAN_TTS_WAIT_REF,
+	CAN_TTS_RUN
+};
+
+//! auto-responder ops, CAN_RESP_CLEAR needs the op only
+enum
+{
+	CAN_RESP_CLEAR = 0,
+	CAN_RESP_SET,
+	CAN_RESP_DATA,					//replace dlc and data of the response only
+	CAN_RESP_REMOVE
+};
+
+//! rule VM ops, CAN_VM_STOP needs the op only
+enum
+{
+	CAN_VM_STOP = 0,
+	CAN_VM_LOAD,					//CAN_USB_VmLoad_t, stops the VM
+	CAN_VM_START					//CAN_USB_VmStart_t
+};
+
+//! E2E ops, CAN_E2E_CLEAR needs the op only
+enum
+{
+	CAN_E2E_CLEAR = 0,
+	CAN_E2E_SET,					//also restarts the counter
+	CAN_E2E_REMOVE
+};
+
+//! E2E flags
+enum
+{
+	CAN_E2E_IDE = 0x01,
+	CAN_E2E_TX = 0x02,				//fill counter and CRC when a mailbox is loaded
+	CAN_E2E_RX = 0x04,				//verify received frames
+	CAN_E2E_H2F = 0x08,				//CRC8H2F (0x2F), otherwise SAE J1850 (0x1D)
+	CAN_E2E_ID16 = 0x10				//both data ID bytes go to the CRC, otherwise the low one
+};
+
+//! ISO-TP ops, CAN_ISOTP_ABORT needs the op only
+enum
+{
+	CAN_ISOTP_ABORT = 0,
+	CAN_ISOTP_CONFIG,
+	CAN_ISOTP_DATA,
+	CAN_ISOTP_SEND,
+	CAN_ISOTP_RX,					//device to host
+	CAN_ISOTP_STAT					//device to host
+};
+
+//! ISO-TP flags
+enum
+{
+	CAN_ISOTP_IDE = 0x01,
+	CAN_ISOTP_PAD = 0x02			//always DLC 8
+};
+
+//! ISO-TP transmission results
+enum
+{
+	CAN_ISOTP_OK = 0,
+	CAN_ISOTP_BUSY,
+	CAN_ISOTP_TIMEOUT,				//no flow control within N_Bs
+	CAN_ISOTP_OVERFLOW,				//receiver refused the size
+	CAN_ISOTP_WAIT_MAX,
+	CAN_ISOTP_BAD_FC,
+	CAN_ISOTP_ABORTED
+};
+
+//! rule VM instructions: r - registers, in - received frame, out - frame to send
+enum
+{
+	CAN_VMI_END = 0,				//done with this frame
+	CAN_VMI_LDI,					//ra = imm16 (b | c << 8)
+	CAN_VMI_LDIH,					//ra[31:16] = imm16
+	CAN_VMI_MOV,					//ra = rb
+	CAN_VMI_ADD,					//ra += rb
+	CAN_VMI_SUB,					//ra -= rb
+	CAN_VMI_AND,					//ra &= rb
+	CAN_VMI_OR,						//ra |= rb
+	CAN_VMI_XOR,					//ra ^= rb
+	CAN_VMI_SHL,					//ra <<= rb & 31
+	CAN_VMI_SHR,					//ra >>= rb & 31
+	CAN_VMI_ADDI,					//ra += (int8_t)b
+	CAN_VMI_ID,						//ra = in.id, bit 31 set for IDE
+	CAN_VMI_FLAGS,					//ra = in.dlc | ide << 4 | rtr << 5
+	CAN_VMI_MATCH,					//END unless ((in.id | ide << 31) ^ ra) & rb == 0
+	CAN_VMI_LDB,					//ra = in.data[b]
+	CAN_VMI_GETB,					//ra = c bits of in.data from bit b, little endian
+	CAN_VMI_JEQ,					//skip c instructions if ra == rb
+	CAN_VMI_JNE,
+	CAN_VMI_JLT,					//unsigned
+	CAN_VMI_JGE,
+	CAN_VMI_JMP,					//skip c instructions
+	CAN_VMI_OUT,					//out = in
+	CAN_VMI_OID,					//out.id = ra, bit 31 selects IDE
+	CAN_VMI_OFL,					//out.dlc = ra & 0x0F, out.rtr = ra bit 5
+	CAN_VMI_STB,					//out.data[b] = ra
+	CAN_VMI_PUTB,					//c bits of out.data from bit b = ra
+	CAN_VMI_SEND					//queue out
+};
+
+//! rule VM verifier results
+enum
+{
+	CAN_VME_OK = 0,
+	CAN_VME_SIZE,
+	CAN_VME_OPCODE,
+	CAN_VME_OPERAND,
+	CAN_VME_JUMP,
+	CAN_VME_BUDGET,					//longest path is over the budget
+	CAN_VME_EMIT					//too many sends on one path
+};
+
+//! signal flags
+enum
+{
+	CAN_SIGF_MOTOROLA = 0x10,		//big endian, start is the MSB
+	CAN_SIGF_SIGNED = 0x20
+};
+
+//! rx policy flags
+enum
+{
+	CAN_RXPF_ON_CHANGE = 0x80		//forward only when masked payload or DLC changes
+};
+
+//! CAN_PT_PACKED records, a keyframe tag carries CAN_USB_Flags_t in the low bits
+enum
+{
+	CAN_PACK_SAME = 0x00,			//slot: payload unchanged
+	CAN_PACK_DELTA,					//slot, byte mask, XOR of the masked bytes with the slot value
+	CAN_PACK_RESET = 0x7F,			//all slots dropped
+	CAN_PACK_KEY = 0x80				//slot, id (2 bytes, 4 if IDE), filter, data: defines the slot
+};
+
+//! filter bank layouts
+enum
+{
+	CAN_FLAYOUT_OFF = 0,
+	CAN_FLAYOUT_LIST16,				//4 exact standard IDs
+	CAN_FLAYOUT_MASK16,				//2 standard ID/mask pairs
+	CAN_FLAYOUT_LIST32,				//2 exact IDs
+	CAN_FLAYOUT_MASK32				//1 ID/mask pair
+};
+
+//! error states
+enum
+{
+	CAN_ESTATE_ACTIVE = 0,
+	CAN_ESTATE_WARNING,
+	CAN_ESTATE_PASSIVE,
+	CAN_ESTATE_BUSOFF
+};
+
+//! last error codes
+enum
+{
+	CAN_LEC_NONE = 0,
+	CAN_LEC_STUFF,
+	CAN_LEC_FORM,
+	CAN_LEC_ACK,
+	CAN_LEC_BIT_RECESSIVE,
+	CAN_LEC_BIT_DOMINANT,
+	CAN_LEC_CRC
+};
+
+//! bus-off recovery
+enum
+{
+	CAN_BUSOFF_MANUAL = 0,			//stay off until the next CAN_PT_BAUD
+	CAN_BUSOFF_AUTO					//hardware recovery after 128x11 recessive bits
+};
+
+//! options
+enum
+{
+	CAN_OPT_BUSOFF = 0,				//CAN_BUSOFF_xxx
+	CAN_OPT_LOAD_WINDOW,			//ms, bus load averaging window
+	CAN_OPT_STATUS_PERIOD,			//ms, unsolicited CAN_PT_STATUS, 0 - on request only
+	CAN_OPT_SW_ACCEPT,				//1 - recheck frames against the exact CAN_PT_FILTER_LIST set
+	CAN_OPT_PACK,					//N - CAN_PT_PACKED stream with a keyframe every N deltas per slot, 0 - CAN_PT_MESS
+	CAN_OPT_SNAPSHOT,				//CAN_SNAP_xxx, a change empties the table. PACK, SNAPSHOT and SIGNALS are exclusive, setting one turns the others off
+	CAN_OPT_ID_STATS,				//CAN_IDSTAT_xxx, a change empties the table
+	CAN_OPT_SIGNALS,				//1 - stream CAN_PT_SIGNAL_DATA instead of frames
+	CAN_OPT_TX_DIRECT,				//1 - cut-through from the USB callback, mailboxes leave in request order (TXFP)
+
+	CAN_OPT_END
+};
+
 //! packet types
 enum
 {
@@ -85,7 +877,25 @@ enum
 	CAN_PT_FILTER,
 	CAN_PT_BAUD,
 	CAN_PT_ERROR,
-	CAN_PT_UID
+	CAN_PT_UID,
+	CAN_PT_STATUS,
+	CAN_PT_OPTION,
+	CAN_PT_FILTER_LIST,
+	CAN_PT_RX_POLICY,
+	CAN_PT_PACKED,					//CAN_PACK_xxx records, see can_pack.h
+	CAN_PT_DATA_FILTER,
+	CAN_PT_CONGESTION,
+	CAN_PT_SNAPSHOT,
+	CAN_PT_ID_STATS,
+	CAN_PT_SIGNALS,
+	CAN_PT_SIGNAL_DATA,				//CAN_USB_SignalRec_t records
+	CAN_PT_PERIODIC,
+	CAN_PT_TIMED,
+	CAN_PT_TT,
+	CAN_PT_RESPONDER,
+	CAN_PT_RULE_VM,
+	CAN_PT_E2E,
+	CAN_PT_ISOTP
 };
 
 //
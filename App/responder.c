@@ -0,0 +1,149 @@
+/*
+ * responder.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "responder.h"
+#include "id_map.h"
+#include "app.h"
+#include "board.h"
+#include <string.h>
+
+//! entry compiled to the same two word compare as the payload filter
+typedef struct
+{
+	uint32_t	key;
+	uint32_t	key_mask;
+	uint32_t	value[2];
+	uint32_t	mask[2];
+	uint8_t		rtr;				//CAN_FENTRY_RTR | CAN_FENTRY_ANY_RTR
+	uint8_t		min_dlc;			//masked bytes must be present
+	uint8_t		used;
+	CAN_USB_Mess_t	response;
+}Responder_t;
+
+static Responder_t entries[RESPONDER_ENTRIES];
+static uint8_t used_count = 0;
+static uint32_t hits[RESPONDER_ENTRIES];
+static uint32_t sent = 0;
+static uint32_t busy = 0;
+
+//
+//Public members
+//
+void responder_clear()
+{
+	__disable_irq();
+	memset(entries, 0, sizeof(entries));
+	memset(hits, 0, sizeof(hits));
+	used_count = 0;
+	sent = busy = 0;
+	__enable_irq();
+}
+
+uint8_t responder_set(const CAN_USB_Responder_t* entry)
+{
+	if (entry->op == CAN_RESP_CLEAR)
+	{
+		responder_clear();
+		return 1;
+	}
+	if (entry->index >= RESPONDER_ENTRIES) return 0;
+
+	Responder_t* e = &entries[entry->index];
+	switch(entry->op)
+	{
+		case CAN_RESP_SET:
+		{
+			uint8_t ide = entry->flags & CAN_FENTRY_IDE;
+			uint32_t full = ide?0x1FFFFFFF:0x7FF;
+
+			Responder_t r;
+			r.key_mask = ID_MAP_KEY(entry->id_mask & full, 1);
+			r.key = ID_MAP_KEY(entry->id, ide) & r.key_mask;
+
+			uint8_t value[8];
+			r.min_dlc = 0;
+			for (uint8_t i = 0; i < 8; i++)
+			{
+				value[i] = entry->data_value[i] & entry->data_mask[i];
+				if (entry->data_mask[i]) r.min_dlc = i + 1;
+			}
+			memcpy(r.value, value, sizeof(r.value));
+			memcpy(r.mask, entry->data_mask, sizeof(r.mask));
+			r.rtr = entry->flags & (CAN_FENTRY_RTR | CAN_FENTRY_ANY_RTR);
+			r.used = 1;
+			r.response = entry->response;
+
+			__disable_irq();
+			if (!e->used) used_count++;
+			*e = r;
+			hits[entry->index] = 0;
+			__enable_irq();
+			return 1;
+		}
+		case CAN_RESP_DATA:
+		{
+			if (!e->used) return 0;
+
+			__disable_irq();
+			e->response.flags.dlc = entry->response.flags.dlc;
+			memcpy(e->response.data, entry->response.data, sizeof(e->response.data));
+			__enable_irq();
+			return 1;
+		}
+		case CAN_RESP_REMOVE:
+		{
+			__disable_irq();
+			if (e->used) used_count--;
+			e->used = 0;
+			__enable_irq();
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+uint8_t responder_active()
+{
+	return used_count;
+}
+
+//
+//Called from the RX ISR for every frame the hardware filters let through.
+//The first matching entry answers, the response takes a mailbox right
+//away or is lost and counted as busy.
+//
+FAST_RUN void responder_pass(const CAN_USB_Mess_t* mess)
+{
+	if (!used_count || mess->flags.echo) return;
+
+	uint32_t key = ID_MAP_KEY(mess->id, mess->flags.ide);
+	uint8_t dlc = mess->flags.rtr?0:mess->flags.dlc;
+	uint32_t d[2];
+	memcpy(d, mess->data, sizeof(d));
+
+	for (uint8_t i = 0; i < RESPONDER_ENTRIES; i++)
+	{
+		const Responder_t* r = &entries[i];
+		if (!r->used || ((key & r->key_mask) != r->key)) continue;
+		if (!(r->rtr & CAN_FENTRY_ANY_RTR) && (mess->flags.rtr != ((r->rtr & CAN_FENTRY_RTR)?1:0))) continue;
+		if ((dlc < r->min_dlc) || ((d[0] & r->mask[0]) != r->value[0]) || ((d[1] & r->mask[1]) != r->value[1])) continue;
+
+		hits[i]++;
+		if (app_can_send(&r->response, 0)) sent++;
+		else busy++;
+		return;
+	}
+}
+
+void responder_stat(CAN_USB_ResponderStat_t* out)
+{
+	out->entries = used_count;
+	out->capacity = RESPONDER_ENTRIES;
+	out->sent = sent;
+	out->busy = busy;
+	memcpy(out->hits, hits, sizeof(out->hits));
+}
@@ -0,0 +1,20 @@
+/*
+ * responder.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef RESPONDER_H_
+#define RESPONDER_H_
+#include "proto.h"
+
+#define RESPONDER_ENTRIES		16
+
+void responder_clear();
+uint8_t responder_set(const CAN_USB_Responder_t* entry);
+uint8_t responder_active();
+void responder_pass(const CAN_USB_Mess_t* mess);
+void responder_stat(CAN_USB_ResponderStat_t* out);
+
+#endif /* RESPONDER_H_ */
@@ -0,0 +1,385 @@
+/*
+ * rule_vm.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "rule_vm.h"
+#include <string.h>
+
+#ifdef RULE_VM_HOST
+#define FAST_RUN
+#define __disable_irq()
+#define __enable_irq()
+#else
+#include "board.h"
+#endif
+
+#define INSN_MAX		(RULE_VM_CODE_MAX/sizeof(Insn_t))
+#define IMM16(i)		((i)->b | ((uint16_t)(i)->c << 8))
+#define IDE_BIT			0x80000000
+
+//! fixed width instruction, jumps are forward only so every program terminates
+typedef struct
+{
+	uint8_t		op;					//CAN_VMI_xxx
+	uint8_t		a;					//destination/first register
+	uint8_t		b;					//second register, byte index, start bit or imm16 low
+	uint8_t		c;					//jump offset, bit length or imm16 high
+}Insn_t;
+
+static Insn_t code[INSN_MAX];
+static uint32_t regs[RULE_VM_REGS];
+static uint16_t insn_count = 0;
+static uint16_t budget = RULE_VM_BUDGET_MAX;
+static uint16_t worst_steps = 0;
+static uint8_t running = 0;
+static uint8_t error = CAN_VME_OK;
+static uint16_t error_pc = 0;
+static RuleVm_Emit_t emit_cb = 0;
+
+static uint32_t runs = 0;
+static uint32_t sent = 0;
+static uint32_t busy = 0;
+static uint32_t aborted = 0;
+
+//
+//Private forwards
+//
+static uint8_t check_insn(const Insn_t* insn, uint16_t pc, uint16_t count);
+static uint32_t bit_mask(uint8_t len);
+
+//
+//Public members
+//
+void rule_vm_init(RuleVm_Emit_t emit)
+{
+	emit_cb = emit;
+	rule_vm_stop();
+	memset(code, 0, sizeof(code));
+	insn_count = 0;
+	error = CAN_VME_OK;
+	error_pc = 0;
+}
+
+void rule_vm_stop()
+{
+	__disable_irq();
+	running = 0;
+	__enable_irq();
+}
+
+uint8_t rule_vm_load(uint16_t offset, const uint8_t* src, uint16_t len)
+{
+	if (((uint32_t)offset + len) > sizeof(code)) return 0;
+
+	rule_vm_stop();
+	memcpy((uint8_t*)code + offset, src, len);
+	return 1;
+}
+
+uint8_t rule_vm_start(const CAN_USB_VmStart_t* start)
+{
+	rule_vm_stop();
+
+	budget = (start->budget && (start->budget < RULE_VM_BUDGET_MAX))?start->budget:RULE_VM_BUDGET_MAX;
+	uint16_t worst = 0;
+	error = rule_vm_verify((const uint8_t*)code, start->size, &worst, &error_pc);
+	if ((error == CAN_VME_OK) && (worst > budget))
+	{
+		error = CAN_VME_BUDGET;
+		error_pc = 0;
+	}
+	if (error != CAN_VME_OK) return 0;
+
+	insn_count = start->size/sizeof(Insn_t);
+	worst_steps = worst;
+	memcpy(regs, start->regs, sizeof(regs));
+	runs = sent = busy = aborted = 0;
+
+	__disable_irq();
+	running = 1;
+	__enable_irq();
+	return 1;
+}
+
+uint8_t rule_vm_active()
+{
+	return running;
+}
+
+//
+//Every instruction is checked once, then the longest path and the most
+//sends on any path come out of one backward pass: jumps only go forward,
+//so the code is a DAG and the worst case is exact, not estimated.
+//
+uint8_t rule_vm_verify(const uint8_t* src, uint16_t size, uint16_t* worst, uint16_t* err_pc)
+{
+	uint8_t steps[INSN_MAX + 1];
+	uint8_t sends[INSN_MAX + 1];
+	const Insn_t* prog = (const Insn_t*)src;
+	uint16_t count = size/sizeof(Insn_t);
+
+	*err_pc = 0;
+	*worst = 0;
+	if (!count || (size % sizeof(Insn_t)) || (count > INSN_MAX)) return CAN_VME_SIZE;
+
+	for (uint16_t pc = 0; pc < count; pc++)
+	{
+		uint8_t res = check_insn(&prog[pc], pc, count);
+		if (res == CAN_VME_OK) continue;
+		*err_pc = pc;
+		return res;
+	}
+
+	steps[count] = sends[count] = 0;
+	for (int16_t pc = count - 1; pc >= 0; pc--)
+	{
+		const Insn_t* i = &prog[pc];
+		uint16_t next = pc + 1;
+		uint16_t jump = next + i->c;
+		uint8_t s = 0;
+		uint8_t e = 0;
+
+		switch(i->op)
+		{
+			case CAN_VMI_END:
+				break;
+			case CAN_VMI_JMP:
+				s = steps[jump];
+				e = sends[jump];
+				break;
+			case CAN_VMI_JEQ:
+			case CAN_VMI_JNE:
+			case CAN_VMI_JLT:
+			case CAN_VMI_JGE:
+				s = (steps[next] > steps[jump])?steps[next]:steps[jump];
+				e = (sends[next] > sends[jump])?sends[next]:sends[jump];
+				break;
+			default:
+				s = steps[next];
+				e = sends[next] + ((i->op == CAN_VMI_SEND)?1:0);
+				break;
+		}
+
+		steps[pc] = s + 1;
+		sends[pc] = e;
+		if (e > RULE_VM_EMIT_MAX)
+		{
+			*err_pc = pc;
+			return CAN_VME_EMIT;
+		}
+	}
+
+	*worst = steps[0];
+	return CAN_VME_OK;
+}
+
+//
+//Called from the RX ISR for every frame the hardware filters let through.
+//The budget is already proven by the verifier, the counter only guards
+//against a corrupted program image.
+//
+FAST_RUN void rule_vm_pass(const CAN_USB_Mess_t* mess)
+{
+	if (!running || mess->flags.echo) return;
+	runs++;
+
+	CAN_USB_Mess_t out;
+	memset(&out, 0, sizeof(out));
+	uint32_t* r = regs;
+	uint16_t left = budget;
+	uint8_t emits = 0;
+	uint16_t pc = 0;
+
+	while (pc < insn_count)
+	{
+		if (!left--)
+		{
+			aborted++;
+			return;
+		}
+
+		const Insn_t* i = &code[pc++];
+		switch(i->op)
+		{
+			case CAN_VMI_END:
+				return;
+			case CAN_VMI_LDI:
+				r[i->a] = IMM16(i);
+				break;
+			case CAN_VMI_LDIH:
+				r[i->a] = (r[i->a] & 0xFFFF) | ((uint32_t)IMM16(i) << 16);
+				break;
+			case CAN_VMI_MOV:
+				r[i->a] = r[i->b];
+				break;
+			case CAN_VMI_ADD:
+				r[i->a] += r[i->b];
+				break;
+			case CAN_VMI_SUB:
+				r[i->a] -= r[i->b];
+				break;
+			case CAN_VMI_AND:
+				r[i->a] &= r[i->b];
+				break;
+			case CAN_VMI_OR:
+				r[i->a] |= r[i->b];
+				break;
+			case CAN_VMI_XOR:
+				r[i->a] ^= r[i->b];
+				break;
+			case CAN_VMI_SHL:
+				r[i->a] <<= (r[i->b] & 31);
+				break;
+			case CAN_VMI_SHR:
+				r[i->a] >>= (r[i->b] & 31);
+				break;
+			case CAN_VMI_ADDI:
+				r[i->a] += (int8_t)i->b;
+				break;
+			case CAN_VMI_ID:
+				r[i->a] = mess->id | (mess->flags.ide?IDE_BIT:0);
+				break;
+			case CAN_VMI_FLAGS:
+				r[i->a] = mess->flags.dlc | (mess->flags.ide << 4) | (mess->flags.rtr << 5);
+				break;
+			case CAN_VMI_MATCH:
+				if (((mess->id | (mess->flags.ide?IDE_BIT:0)) ^ r[i->a]) & r[i->b]) return;
+				break;
+			case CAN_VMI_LDB:
+				r[i->a] = mess->data[i->b];
+				break;
+			case CAN_VMI_GETB:
+			{
+				uint64_t v;
+				memcpy(&v, mess->data, sizeof(v));
+				r[i->a] = (v >> i->b) & bit_mask(i->c);
+				break;
+			}
+			case CAN_VMI_JEQ:
+				if (r[i->a] == r[i->b]) pc += i->c;
+				break;
+			case CAN_VMI_JNE:
+				if (r[i->a] != r[i->b]) pc += i->c;
+				break;
+			case CAN_VMI_JLT:
+				if (r[i->a] < r[i->b]) pc += i->c;
+				break;
+			case CAN_VMI_JGE:
+				if (r[i->a] >= r[i->b]) pc += i->c;
+				break;
+			case CAN_VMI_JMP:
+				pc += i->c;
+				break;
+			case CAN_VMI_OUT:
+				out = *mess;
+				out.flags.echo = 0;
+				break;
+			case CAN_VMI_OID:
+				out.id = r[i->a] & 0x1FFFFFFF;
+				out.flags.ide = (r[i->a] & IDE_BIT)?1:0;
+				break;
+			case CAN_VMI_OFL:
+			{
+				uint8_t dlc = r[i->a] & 0x0F;
+				out.flags.dlc = (dlc > 8)?8:dlc;
+				out.flags.rtr = (r[i->a] >> 5) & 1;
+				break;
+			}
+			case CAN_VMI_STB:
+				out.data[i->b] = r[i->a];
+				break;
+			case CAN_VMI_PUTB:
+			{
+				uint64_t v;
+				uint64_t m = (uint64_t)bit_mask(i->c) << i->b;
+				memcpy(&v, out.data, sizeof(v));
+				v = (v & ~m) | (((uint64_t)r[i->a] << i->b) & m);
+				memcpy(out.data, &v, sizeof(v));
+				break;
+			}
+			case CAN_VMI_SEND:
+				if (emits++ >= RULE_VM_EMIT_MAX) break;
+				if (emit_cb && emit_cb(&out)) sent++;
+				else busy++;
+				break;
+			default:
+				aborted++;
+				return;
+		}
+	}
+}
+
+void rule_vm_stat(CAN_USB_VmStat_t* out)
+{
+	out->state = running;
+	out->error = error;
+	out->error_pc = error_pc;
+	out->size = insn_count*sizeof(Insn_t);
+	out->worst_steps = worst_steps;
+	out->budget = budget;
+	out->runs = runs;
+	out->sent = sent;
+	out->busy = busy;
+	out->aborted = aborted;
+	__disable_irq();
+	memcpy(out->regs, regs, sizeof(out->regs));
+	__enable_irq();
+}
+
+//
+//Private members
+//
+static uint8_t check_insn(const Insn_t* i, uint16_t pc, uint16_t count)
+{
+	uint8_t ra = i->a < RULE_VM_REGS;
+	uint8_t rb = i->b < RULE_VM_REGS;
+
+	switch(i->op)
+	{
+		case CAN_VMI_END:
+		case CAN_VMI_OUT:
+		case CAN_VMI_SEND:
+			return CAN_VME_OK;
+		case CAN_VMI_JMP:
+			return ((pc + 1 + i->c) <= count)?CAN_VME_OK:CAN_VME_JUMP;
+		case CAN_VMI_LDI:
+		case CAN_VMI_LDIH:
+		case CAN_VMI_ADDI:
+		case CAN_VMI_ID:
+		case CAN_VMI_FLAGS:
+		case CAN_VMI_OID:
+		case CAN_VMI_OFL:
+			return ra?CAN_VME_OK:CAN_VME_OPERAND;
+		case CAN_VMI_MOV:
+		case CAN_VMI_ADD:
+		case CAN_VMI_SUB:
+		case CAN_VMI_AND:
+		case CAN_VMI_OR:
+		case CAN_VMI_XOR:
+		case CAN_VMI_SHL:
+		case CAN_VMI_SHR:
+		case CAN_VMI_MATCH:
+			return (ra && rb)?CAN_VME_OK:CAN_VME_OPERAND;
+		case CAN_VMI_LDB:
+		case CAN_VMI_STB:
+			return (ra && (i->b < 8))?CAN_VME_OK:CAN_VME_OPERAND;
+		case CAN_VMI_GETB:
+		case CAN_VMI_PUTB:
+			return (ra && i->c && (i->c <= 32) && ((i->b + i->c) <= 64))?CAN_VME_OK:CAN_VME_OPERAND;
+		case CAN_VMI_JEQ:
+		case CAN_VMI_JNE:
+		case CAN_VMI_JLT:
+		case CAN_VMI_JGE:
+			if (!ra || !rb) return CAN_VME_OPERAND;
+			return ((pc + 1 + i->c) <= count)?CAN_VME_OK:CAN_VME_JUMP;
+	}
+
+	return CAN_VME_OPCODE;
+}
+
+static FAST_RUN uint32_t bit_mask(uint8_t len)
+{
+	return (len < 32)?((1UL << len) - 1):0xFFFFFFFF;
+}
@@ -0,0 +1,33 @@
+/*
+ * rule_vm.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef RULE_VM_H_
+#define RULE_VM_H_
+#include "proto.h"
+
+//
+//Reactive rule interpreter. Builds on the host with -DRULE_VM_HOST,
+//the target only adds the mailbox glue through the emit callback.
+//
+#define RULE_VM_CODE_MAX		512		//bytes, 4 per instruction
+#define RULE_VM_REGS			8
+#define RULE_VM_BUDGET_MAX		128		//instructions per received frame
+#define RULE_VM_EMIT_MAX		4		//frames sent per received frame
+
+//! returns 0 when the frame couldn't be queued
+typedef uint8_t (*RuleVm_Emit_t)(const CAN_USB_Mess_t* mess);
+
+void rule_vm_init(RuleVm_Emit_t emit);
+void rule_vm_stop();
+uint8_t rule_vm_load(uint16_t offset, const uint8_t* code, uint16_t len);
+uint8_t rule_vm_start(const CAN_USB_VmStart_t* start);
+uint8_t rule_vm_active();
+uint8_t rule_vm_verify(const uint8_t* code, uint16_t size, uint16_t* worst, uint16_t* err_pc);
+void rule_vm_pass(const CAN_USB_Mess_t* mess);
+void rule_vm_stat(CAN_USB_VmStat_t* out);
+
+#endif /* RULE_VM_H_ */
@@ -0,0 +1,37 @@
+/*
+ * rx_arena.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "rx_arena.h"
+
+//
+//Packed stream and snapshot are exclusive output modes, so their tables
+//share one block. The mode switched off gives it up before the other one
+//takes it, see set_option().
+//
+static uint32_t arena[RX_ARENA_SIZE/sizeof(uint32_t)];
+static uint8_t owner = RX_ARENA_FREE;
+
+//
+//Public members
+//
+
+//0 while another user holds the tables
+void* rx_arena_take(uint8_t user)
+{
+	if ((owner != RX_ARENA_FREE) && (owner != user)) return 0;
+	owner = user;
+	return arena;
+}
+
+void rx_arena_release(uint8_t user)
+{
+	if (owner == user) owner = RX_ARENA_FREE;
+}
+
+uint8_t rx_arena_user()
+{
+	return owner;
+}
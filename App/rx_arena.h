@@ -0,0 +1,26 @@
+/*
+ * rx_arena.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef RX_ARENA_H_
+#define RX_ARENA_H_
+#include <stdint.h>
+
+#define RX_ARENA_SIZE		5120		//the largest user, snapshot tables
+
+//! users of the shared tables, one at a time
+typedef enum
+{
+	RX_ARENA_FREE = 0,
+	RX_ARENA_PACK,
+	RX_ARENA_SNAPSHOT
+}RX_Arena_User_t;
+
+void* rx_arena_take(uint8_t user);
+void rx_arena_release(uint8_t user);
+uint8_t rx_arena_user();
+
+#endif /* RX_ARENA_H_ */
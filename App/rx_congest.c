@@ -0,0 +1,135 @@
+/*
+ * rx_congest.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "rx_congest.h"
+#include "id_map.h"
+#include "board.h"
+#include <string.h>
+
+#define CACHE_HASH(key)		(((key)*0x9E3779B1U) >> (32 - RX_CONGEST_CACHE_BITS))
+
+static CAN_USB_MessPck_t* ring = 0;
+static uint16_t ring_size = 0;
+
+static CAN_USB_Congestion_t config;
+static uint32_t prio_key = 0;
+static uint8_t congested = 0;
+static uint16_t fill = 0;
+static uint16_t max_fill = 0;
+static uint32_t episodes = 0;
+static uint32_t dropped = 0;
+static uint32_t conflated = 0;
+
+//ring slot of the newest frame per hash bucket, checked before use
+static uint16_t last_slot[1 << RX_CONGEST_CACHE_BITS];
+
+//
+//Private forwards
+//
+static uint32_t arbitration_key(uint32_t id, uint8_t ide);
+
+//
+//Public members
+//
+void rx_congest_init(CAN_USB_MessPck_t* buf, uint16_t size)
+{
+	ring = buf;
+	ring_size = size;
+	memset(last_slot, 0xFF, sizeof(last_slot));
+
+	CAN_USB_Congestion_t cfg;
+	cfg.flags = 0;
+	cfg.high = (size*3)/4;
+	cfg.low = size/2;
+	cfg.prio_id = 0x7FF;
+	rx_congest_set(&cfg);
+}
+
+uint8_t rx_congest_set(const CAN_USB_Congestion_t* cfg)
+{
+	if ((cfg->high >= ring_size) || (cfg->low > cfg->high)) return 0;
+
+	__disable_irq();
+	config = *cfg;
+	prio_key = arbitration_key(cfg->prio_id, cfg->flags & CAN_CONG_PRIO_IDE);
+	congested = 0;
+	dropped = conflated = episodes = 0;
+	max_fill = 0;
+	__enable_irq();
+
+	return 1;
+}
+
+void rx_congest_stat(CAN_USB_CongestionStat_t* out)
+{
+	out->config = config;
+	out->congested = congested;
+	out->fill = fill;
+	out->max_fill = max_fill;
+	out->episodes = episodes;
+	out->dropped = dropped;
+	out->conflated = conflated;
+}
+
+//
+//Called from the RX ISR with mess already read into ring[head] (or a
+//scratch copy when the ring is full). Returns RX_CONGEST_KEEP to enqueue
+//it, RX_CONGEST_DROP, or a pending slot of the same ID to overwrite.
+//Fill counts every slot still held from tail, only [sent, head) may be
+//overwritten: slots before sent are lent to USB and the one at sent may
+//be the one the main loop is copying out.
+//
+FAST_RUN uint16_t rx_congest_pass(const CAN_USB_Mess_t* mess, uint16_t head, uint16_t tail, uint16_t sent)
+{
+	uint16_t mask = ring_size - 1;
+	fill = (head - tail) & mask;
+	if (fill > max_fill) max_fill = fill;
+
+	if (!congested && (fill >= config.high))
+	{
+		congested = 1;
+		episodes++;
+	}
+	else if (congested && (fill <= config.low))
+		congested = 0;
+
+	uint32_t key = ID_MAP_KEY(mess->id, mess->flags.ide);
+	uint16_t* cached = &last_slot[CACHE_HASH(key)];
+
+	if (congested && (config.flags & CAN_CONG_CONFLATE))
+	{
+		uint16_t slot = *cached;
+		if ((slot != 0xFFFF) && (slot != sent) && (((slot - sent) & mask) < ((head - sent) & mask)))
+		{
+			const CAN_USB_Mess_t* old = &ring[slot].mess;
+			if ((old->id == mess->id) && (old->flags.ide == mess->flags.ide))
+			{
+				conflated++;
+				return slot;
+			}
+		}
+	}
+
+	if (congested && (config.flags & CAN_CONG_DROP) && (arbitration_key(mess->id, mess->flags.ide) > prio_key))
+	{
+		dropped++;
+		return RX_CONGEST_DROP;
+	}
+
+	*cached = head;
+	return RX_CONGEST_KEEP;
+}
+
+//
+//Private members
+//
+
+//lower wins arbitration, a standard frame beats an extended one with the same base ID
+static FAST_RUN uint32_t arbitration_key(uint32_t id, uint8_t ide)
+{
+	if (ide) return ((id & 0x1FFFFFFF) << 1) | 1;
+	return (id & 0x7FF) << 19;
+}
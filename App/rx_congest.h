@@ -0,0 +1,21 @@
+/*
+ * rx_congest.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef RX_CONGEST_H_
+#define RX_CONGEST_H_
+#include "proto.h"
+
+#define RX_CONGEST_CACHE_BITS	8
+#define RX_CONGEST_KEEP			0xFFFF
+#define RX_CONGEST_DROP			0xFFFE
+
+void rx_congest_init(CAN_USB_MessPck_t* ring, uint16_t size);
+uint8_t rx_congest_set(const CAN_USB_Congestion_t* cfg);
+void rx_congest_stat(CAN_USB_CongestionStat_t* out);
+uint16_t rx_congest_pass(const CAN_USB_Mess_t* mess, uint16_t head, uint16_t tail, uint16_t sent);
+
+#endif /* RX_CONGEST_H_ */
@@ -0,0 +1,129 @@
+/*
+ * rx_pack.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "rx_pack.h"
+#include "id_map.h"
+#include "rx_arena.h"
+#include "board.h"
+#include <string.h>
+
+#define FRAME_USB_BYTES		(sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_Mess_t))
+
+//! dictionary, lives in the RX arena while packing is on
+typedef struct
+{
+	uint32_t		map_keys[1 << RX_PACK_BITS];
+	uint16_t		map_items[1 << RX_PACK_BITS];
+	Can_Pack_Slot_t	dict[RX_PACK_SLOTS];		//a used slot's frame gives its map key
+}Rx_Pack_Tables_t;
+
+_Static_assert(sizeof(Rx_Pack_Tables_t) <= RX_ARENA_SIZE, "rx_pack tables don't fit the RX arena");
+_Static_assert(RX_PACK_SLOTS <= CAN_PACK_SLOTS, "slot numbers are one byte on the wire");
+_Static_assert(RX_PACK_SLOTS < (1 << RX_PACK_BITS), "the map needs empty slots to end a probe");
+
+static Rx_Pack_Tables_t* t = 0;
+static Id_Map_t map;
+static uint16_t victim = 0;
+static uint8_t key_every = 0;
+static uint8_t reset_pending = 0;
+static uint32_t saved = 0;
+
+//
+//Private forwards
+//
+static uint8_t get_slot(uint32_t key);
+
+//
+//Public members
+//
+void rx_pack_init()
+{
+	t = 0;
+	victim = 0;
+	key_every = 0;
+	reset_pending = 0;
+	saved = 0;
+}
+
+//
+//0 - plain CAN_PT_MESS stream. Any change restarts the dictionary, the
+//host decoder is told so by CAN_PACK_RESET in front of the next record.
+//Returns 0 if the RX arena is taken by another mode.
+//
+uint8_t rx_pack_set(uint8_t every)
+{
+	if (!every)
+	{
+		key_every = 0;
+		reset_pending = 0;
+		rx_arena_release(RX_ARENA_PACK);
+		return 1;
+	}
+
+	Rx_Pack_Tables_t* tables = rx_arena_take(RX_ARENA_PACK);
+	if (!tables) return 0;
+
+	t = tables;
+	id_map_init(&map, t->map_keys, t->map_items, RX_PACK_BITS);
+	map.limit = RX_PACK_SLOTS;		//fuller than the default: more IDs in the same arena
+	memset(t->dict, 0, sizeof(t->dict));
+	victim = 0;
+	key_every = every;
+	reset_pending = 1;
+	return 1;
+}
+
+uint8_t rx_pack_get()
+{
+	return key_every;
+}
+
+FAST_RUN uint8_t rx_pack_frame(const CAN_USB_Mess_t* mess, uint8_t* out)
+{
+	uint8_t len = 0;
+	if (reset_pending)
+	{
+		out[len++] = CAN_PACK_RESET;
+		reset_pending = 0;
+	}
+
+	uint8_t slot = get_slot(ID_MAP_KEY(mess->id, mess->flags.ide));
+	len += can_pack_record(t->dict, slot, mess, key_every, &out[len]);
+	if (len < FRAME_USB_BYTES)
+		saved += FRAME_USB_BYTES - len;
+
+	return len;
+}
+
+uint32_t rx_pack_saved()
+{
+	return saved;
+}
+
+//
+//Private members
+//
+
+//slots are handed out in order, once all are taken the oldest one is reused
+static FAST_RUN uint8_t get_slot(uint32_t key)
+{
+	uint16_t slot = id_map_find(&map, key);
+	if (slot != ID_MAP_NONE) return slot;
+
+	if (map.count < RX_PACK_SLOTS)
+		slot = map.count;
+	else
+	{
+		slot = victim;
+		victim = (victim + 1) % RX_PACK_SLOTS;
+		const CAN_USB_Mess_t* old = &t->dict[slot].mess;
+		id_map_remove(&map, ID_MAP_KEY(old->id, old->flags.ide));
+	}
+
+	id_map_insert(&map, key, slot);
+	t->dict[slot].valid = 0;
+	return slot;
+}
@@ -0,0 +1,22 @@
+/*
+ * rx_pack.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef RX_PACK_H_
+#define RX_PACK_H_
+#include "can_pack.h"
+
+#define RX_PACK_BITS			8
+#define RX_PACK_SLOTS			192		//dictionary slots used, map load 0.75
+#define RX_PACK_RECORD_MAX		(CAN_PACK_RECORD_MAX + 1)	//a pending reset goes first
+
+void rx_pack_init();
+uint8_t rx_pack_set(uint8_t key_every);
+uint8_t rx_pack_get();
+uint8_t rx_pack_frame(const CAN_USB_Mess_t* mess, uint8_t* out);
+uint32_t rx_pack_saved();
+
+#endif /* RX_PACK_H_ */
@@ -0,0 +1,312 @@
+/*
+ * rx_policy.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "rx_policy.h"
+#include "id_map.h"
+#include "board.h"
+#include <string.h>
+
+#define FRAME_USB_BYTES		(sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_Mess_t))
+#define NO_RANGE			0xFF
+
+//! per ID rule and state
+typedef struct
+{
+	uint32_t	min_interval;		//us, 0 - no limit
+	uint32_t	heartbeat;			//us, 0 - never
+	uint32_t	data_mask[2];
+	uint32_t	data[2];			//last forwarded payload
+	uint32_t	last;				//us, last forwarded
+	uint16_t	every_n;			//0, 1 - every frame
+	uint16_t	n;
+	uint8_t		on_change;
+	uint8_t		dlc;				//last forwarded DLC
+	uint8_t		fresh;				//nothing forwarded yet
+	uint8_t		range;				//template index, NO_RANGE - own entry
+	uint8_t		gen;				//template generation it was made from
+}Rx_Policy_t;
+
+//! range template
+typedef struct
+{
+	uint32_t	key;
+	uint32_t	mask;
+	Rx_Policy_t	rule;
+	uint8_t		gen;
+	uint8_t		used;
+}Rx_Range_t;
+
+static uint32_t map_keys[1 << RX_POLICY_BITS];
+static uint16_t map_items[1 << RX_POLICY_BITS];
+static Id_Map_t map;
+
+static Rx_Policy_t items[RX_POLICY_ITEMS];
+static uint16_t free_items[RX_POLICY_ITEMS];
+static uint16_t free_count = 0;
+
+static Rx_Range_t ranges[RX_POLICY_RANGES];
+static uint8_t ranges_count = 0;
+
+static uint32_t matched = 0;
+static uint32_t suppressed = 0;
+static uint32_t unchanged = 0;
+static uint32_t untracked = 0;
+
+//
+//Private forwards
+//
+static void make_rule(Rx_Policy_t* rule, const CAN_USB_RxPolicy_t* p);
+static void reset_state(Rx_Policy_t* pol);
+static uint16_t from_range(uint32_t key);
+
+//
+//Public members
+//
+void rx_policy_init()
+{
+	id_map_init(&map, map_keys, map_items, RX_POLICY_BITS);
+	rx_policy_clear();
+}
+
+void rx_policy_clear()
+{
+	__disable_irq();
+	id_map_clear(&map);
+	for (uint16_t i = 0; i < RX_POLICY_ITEMS; i++)
+		free_items[i] = RX_POLICY_ITEMS - 1 - i;
+	free_count = RX_POLICY_ITEMS;
+	memset(ranges, 0, sizeof(ranges));
+	ranges_count = 0;
+	matched = suppressed = unchanged = untracked = 0;
+	__enable_irq();
+}
+
+uint8_t rx_policy_set(const CAN_USB_RxPolicy_t* p)
+{
+	uint8_t ide = p->flags & CAN_FENTRY_IDE;
+	uint32_t full = ide?0x1FFFFFFF:0x7FF;
+	uint32_t id_mask = p->id_mask & full;
+	uint8_t res = 1;
+
+	Rx_Policy_t rule;
+	make_rule(&rule, p);
+
+	__disable_irq();
+	if (id_mask != full)
+	{
+		//ranges: entries made from the old template refresh on their next frame
+		uint32_t key = ID_MAP_KEY(p->id & id_mask, ide);
+		uint32_t mask = ID_MAP_KEY(id_mask, 1);
+		Rx_Range_t* r = 0;
+		for (uint8_t i = 0; i < RX_POLICY_RANGES; i++)
+		{
+			if (ranges[i].used && (ranges[i].key == key) && (ranges[i].mask == mask))
+			{
+				r = &ranges[i];
+				break;
+			}
+			if (!r && !ranges[i].used) r = &ranges[i];
+		}
+
+		if (r)
+		{
+			if (!r->used) ranges_count++;
+			r->key = key;
+			r->mask = mask;
+			r->rule = rule;
+			r->gen++;
+			r->used = 1;
+		}
+		else
+			res = 0;
+	}
+	else
+	{
+		uint32_t key = ID_MAP_KEY(p->id, ide);
+		uint16_t item = id_map_find(&map, key);
+		if (item == ID_MAP_NONE)
+		{
+			if (free_count && id_map_insert(&map, key, free_items[free_count - 1]))
+				item = free_items[--free_count];
+			else
+				res = 0;
+		}
+
+		if (res)
+			items[item] = rule;
+	}
+	__enable_irq();
+
+	return res;
+}
+
+uint8_t rx_policy_remove(const CAN_USB_RxPolicy_t* p)
+{
+	uint8_t ide = p->flags & CAN_FENTRY_IDE;
+	uint32_t full = ide?0x1FFFFFFF:0x7FF;
+	uint32_t id_mask = p->id_mask & full;
+	uint8_t res = 0;
+
+	__disable_irq();
+	if (id_mask != full)
+	{
+		uint32_t key = ID_MAP_KEY(p->id & id_mask, ide);
+		uint32_t mask = ID_MAP_KEY(id_mask, 1);
+		for (uint8_t i = 0; i < RX_POLICY_RANGES; i++)
+		{
+			if (ranges[i].used && (ranges[i].key == key) && (ranges[i].mask == mask))
+			{
+				ranges[i].used = 0;
+				ranges[i].gen++;
+				ranges_count--;
+				res = 1;
+			}
+		}
+	}
+	else
+	{
+		uint16_t item = id_map_remove(&map, ID_MAP_KEY(p->id, ide));
+		if (item != ID_MAP_NONE)
+		{
+			free_items[free_count++] = item;
+			res = 1;
+		}
+	}
+	__enable_irq();
+
+	return res;
+}
+
+//
+//Called from the RX ISR, 1 - forward the frame.
+//An on-change hit costs one lookup and a masked compare of two words.
+//
+FAST_RUN uint8_t rx_policy_pass(const CAN_USB_Mess_t* mess, uint32_t now)
+{
+	if (!map.count && !ranges_count) return 1;
+
+	uint32_t key = ID_MAP_KEY(mess->id, mess->flags.ide);
+	uint16_t item = id_map_find(&map, key);
+	if (item == ID_MAP_NONE)
+	{
+		if (!ranges_count) return 1;
+		item = from_range(key);
+		if (item == ID_MAP_NONE) return 1;
+	}
+
+	Rx_Policy_t* pol = &items[item];
+	if (pol->range != NO_RANGE)
+	{
+		//template changed or removed since this entry was made
+		uint8_t range = pol->range;
+		Rx_Range_t* r = &ranges[range];
+		if (pol->gen != r->gen)
+		{
+			if (!r->used || ((key ^ r->key) & r->mask))
+			{
+				free_items[free_count++] = id_map_remove(&map, key);
+				return 1;
+			}
+			*pol = r->rule;
+			pol->range = range;
+			pol->gen = r->gen;
+		}
+	}
+	matched++;
+
+	uint8_t pass = 1;
+	if (pol->every_n > 1)
+	{
+		pass = (pol->n == 0);
+		if (++pol->n >= pol->every_n) pol->n = 0;
+	}
+
+	if (pass && pol->min_interval && !pol->fresh)
+		pass = ((now - pol->last) >= pol->min_interval);
+
+	uint32_t d0, d1;
+	memcpy(&d0, &mess->data[0], 4);
+	memcpy(&d1, &mess->data[4], 4);
+	if (pass && pol->on_change && !pol->fresh)
+	{
+		uint32_t diff = ((d0 ^ pol->data[0]) & pol->data_mask[0]) | ((d1 ^ pol->data[1]) & pol->data_mask[1]);
+		if (!diff && (mess->flags.dlc == pol->dlc) && !(pol->heartbeat && ((now - pol->last) >= pol->heartbeat)))
+		{
+			unchanged++;
+			pass = 0;
+		}
+	}
+
+	if (!pass)
+	{
+		suppressed++;
+		return 0;
+	}
+
+	pol->last = now;
+	pol->fresh = 0;
+	pol->data[0] = d0;
+	pol->data[1] = d1;
+	pol->dlc = mess->flags.dlc;
+	return 1;
+}
+
+void rx_policy_stat(CAN_USB_RxPolicyStat_t* out)
+{
+	out->entries = map.count;
+	out->capacity = RX_POLICY_ITEMS;
+	out->matched = matched;
+	out->suppressed = suppressed;
+	out->bytes_saved = suppressed*FRAME_USB_BYTES;
+	out->ranges = ranges_count;
+	out->unchanged = unchanged;
+	out->untracked = untracked;
+}
+
+//
+//Private members
+//
+static void make_rule(Rx_Policy_t* rule, const CAN_USB_RxPolicy_t* p)
+{
+	memset(rule, 0, sizeof(Rx_Policy_t));
+	rule->min_interval = p->min_interval_us;
+	rule->every_n = p->every_n;
+	rule->on_change = (p->flags & CAN_RXPF_ON_CHANGE)?1:0;
+	rule->heartbeat = p->heartbeat_us;
+	memcpy(rule->data_mask, p->data_mask, sizeof(rule->data_mask));
+	rule->range = NO_RANGE;
+	reset_state(rule);
+}
+
+static void reset_state(Rx_Policy_t* pol)
+{
+	pol->n = 0;
+	pol->fresh = 1;
+}
+
+//first matching template gets its own per ID entry
+static FAST_RUN uint16_t from_range(uint32_t key)
+{
+	for (uint8_t i = 0; i < RX_POLICY_RANGES; i++)
+	{
+		Rx_Range_t* r = &ranges[i];
+		if (!r->used || ((key ^ r->key) & r->mask)) continue;
+
+		if (!free_count || !id_map_insert(&map, key, free_items[free_count - 1]))
+		{
+			untracked++;
+			return ID_MAP_NONE;
+		}
+
+		uint16_t item = free_items[--free_count];
+		items[item] = r->rule;
+		items[item].range = i;
+		items[item].gen = r->gen;
+		return item;
+	}
+
+	return ID_MAP_NONE;
+}
@@ -0,0 +1,23 @@
+/*
+ * rx_policy.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef RX_POLICY_H_
+#define RX_POLICY_H_
+#include "proto.h"
+
+#define RX_POLICY_BITS		8
+#define RX_POLICY_ITEMS		((1 << RX_POLICY_BITS)/2)
+#define RX_POLICY_RANGES	8
+
+void rx_policy_init();
+void rx_policy_clear();
+uint8_t rx_policy_set(const CAN_USB_RxPolicy_t* p);
+uint8_t rx_policy_remove(const CAN_USB_RxPolicy_t* p);
+uint8_t rx_policy_pass(const CAN_USB_Mess_t* mess, uint32_t now);
+void rx_policy_stat(CAN_USB_RxPolicyStat_t* out);
+
+#endif /* RX_POLICY_H_ */
@@ -0,0 +1,48 @@
+/*
+ * rx_span.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "rx_span.h"
+#include "board.h"
+
+//
+//Public members
+//
+void rx_span_init(Rx_Span_t* r, uint16_t size)
+{
+	r->head = r->tail = r->sent = 0;
+	r->size = size;
+}
+
+//a lent span is given back once USB is done with it, 0 while it is not
+FAST_RUN uint8_t rx_span_release(Rx_Span_t* r, uint8_t busy)
+{
+	if (r->sent == r->tail) return 1;
+	if (busy) return 0;
+	r->tail = r->sent;
+	return 1;
+}
+
+//copy-out path: the slot at tail is consumed, nothing stays lent
+FAST_RUN uint16_t rx_span_take(Rx_Span_t* r)
+{
+	uint16_t slot = r->tail;
+	r->tail = r->sent = (slot + 1) & (r->size - 1);
+	return slot;
+}
+
+//frames readable in place from tail, up to max and the end of the ring
+FAST_RUN uint16_t rx_span_avail(const Rx_Span_t* r, uint16_t head, uint16_t max)
+{
+	uint16_t end = (head >= r->tail)?head:r->size;
+	uint16_t span = end - r->tail;
+	return (span > max)?max:span;
+}
+
+//count frames from tail are handed to USB, they stay held until released
+FAST_RUN void rx_span_lend(Rx_Span_t* r, uint16_t count)
+{
+	r->sent = (r->tail + count) & (r->size - 1);
+}
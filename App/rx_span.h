@@ -0,0 +1,28 @@
+/*
+ * rx_span.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef RX_SPAN_H_
+#define RX_SPAN_H_
+#include <stdint.h>
+
+//! CAN RX ring indices. The ISR fills at head, the main loop either copies
+//! frames out one by one or lends a contiguous span to USB in place.
+typedef struct
+{
+	volatile uint16_t head;		//next slot the RX ISR fills
+	uint16_t tail;				//oldest slot still held
+	uint16_t sent;				//end of the span lent to USB, tail when none is
+	uint16_t size;				//slots, a power of two
+}Rx_Span_t;
+
+void rx_span_init(Rx_Span_t* r, uint16_t size);
+uint8_t rx_span_release(Rx_Span_t* r, uint8_t busy);
+uint16_t rx_span_take(Rx_Span_t* r);
+uint16_t rx_span_avail(const Rx_Span_t* r, uint16_t head, uint16_t max);
+void rx_span_lend(Rx_Span_t* r, uint16_t count);
+
+#endif /* RX_SPAN_H_ */
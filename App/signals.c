@@ -0,0 +1,182 @@
+/*
+ * signals.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "signals.h"
+#include "id_map.h"
+#include "board.h"
+#include <string.h>
+
+#define NO_SIGNAL		0xFF
+
+//! signal compiled to a shift and mask of the payload as one 64 bit word
+typedef struct
+{
+	uint32_t	mask;
+	uint32_t	sign;			//sign bit, 0 - unsigned
+	uint8_t		shift;
+	uint8_t		motorola;		//shift applies to the big endian view
+	uint8_t		bytes;			//on the wire
+	uint8_t		next;			//next signal of the same ID
+}Signal_t;
+
+//! signals of an ID
+typedef struct
+{
+	uint8_t		first;
+	uint8_t		last;
+	uint8_t		index;			//upload index of first, names the ID on the wire
+	uint8_t		bytes;
+}Signal_Group_t;
+
+static uint32_t map_keys[1 << SIGNALS_BITS];
+static uint16_t map_items[1 << SIGNALS_BITS];
+static Id_Map_t map;
+
+static Signal_t signals[SIGNALS_MAX];
+static uint8_t signals_count = 0;
+static Signal_Group_t groups[SIGNALS_MAX];
+static uint8_t enabled = 0;
+static uint32_t records = 0;
+static uint32_t frames_bytes = 0;
+static uint32_t records_bytes = 0;
+
+//
+//Public members
+//
+void signals_init()
+{
+	id_map_init(&map, map_keys, map_items, SIGNALS_BITS);
+	signals_clear();
+}
+
+void signals_clear()
+{
+	__disable_irq();
+	id_map_clear(&map);
+	signals_count = 0;
+	records = frames_bytes = records_bytes = 0;
+	__enable_irq();
+}
+
+//
+//start is the DBC start bit: the LSB for Intel, the MSB for Motorola
+//byte order, bit 0 being the LSB of data[0].
+//
+uint8_t signals_add(const CAN_USB_Signal_t* sig)
+{
+	if (signals_count >= SIGNALS_MAX) return 0;
+	if (!sig->length || (sig->length > 32) || (sig->start > 63)) return 0;
+
+	Signal_t s;
+	s.motorola = (sig->flags & CAN_SIGF_MOTOROLA)?1:0;
+	if (s.motorola)
+	{
+		//data[0] is the top byte of the big endian view
+		int8_t msb = (7 - sig->start/8)*8 + sig->start%8;
+		if ((msb - sig->length + 1) < 0) return 0;
+		s.shift = msb - sig->length + 1;
+	}
+	else
+	{
+		if ((sig->start + sig->length) > 64) return 0;
+		s.shift = sig->start;
+	}
+	s.mask = (sig->length == 32)?0xFFFFFFFF:((1U << sig->length) - 1);
+	s.sign = (sig->flags & CAN_SIGF_SIGNED)?(1U << (sig->length - 1)):0;
+	s.bytes = (sig->length + 7)/8;
+	s.next = NO_SIGNAL;
+
+	uint8_t idx = signals_count;
+	uint32_t key = ID_MAP_KEY(sig->id, sig->flags & CAN_FENTRY_IDE);
+	uint16_t g = id_map_find(&map, key);
+	if (g != ID_MAP_NONE)
+	{
+		if ((groups[g].bytes + s.bytes) > SIGNALS_VALUES_MAX) return 0;
+	}
+	else
+		g = map.count;
+
+	__disable_irq();
+	signals[idx] = s;
+	if (g == map.count)
+	{
+		id_map_insert(&map, key, g);
+		groups[g].first = groups[g].last = groups[g].index = idx;
+		groups[g].bytes = s.bytes;
+	}
+	else
+	{
+		signals[groups[g].last].next = idx;
+		groups[g].last = idx;
+		groups[g].bytes += s.bytes;
+	}
+	signals_count++;
+	__enable_irq();
+
+	return 1;
+}
+
+void signals_enable(uint8_t on)
+{
+	enabled = on?1:0;
+}
+
+uint8_t signals_enabled()
+{
+	return enabled;
+}
+
+//called from the RX ISR: with signals on only frames carrying some are queued
+FAST_RUN uint8_t signals_pass(const CAN_USB_Mess_t* mess)
+{
+	if (!enabled) return 1;
+	if (mess->flags.rtr) return 0;
+	return (id_map_find(&map, ID_MAP_KEY(mess->id, mess->flags.ide)) != ID_MAP_NONE);
+}
+
+//
+//Writes a CAN_USB_SignalRec_t followed by the values of the frame ID,
+//returns its length, 0 if the ID has no signals.
+//Every signal costs a 64 bit shift, a mask and a sign extension.
+//
+FAST_RUN uint8_t signals_extract(const CAN_USB_Mess_t* mess, uint32_t time, uint8_t* out)
+{
+	uint16_t g = id_map_find(&map, ID_MAP_KEY(mess->id, mess->flags.ide));
+	if (g == ID_MAP_NONE) return 0;
+
+	uint64_t intel, motorola;
+	memcpy(&intel, mess->data, sizeof(intel));
+	motorola = __builtin_bswap64(intel);
+
+	CAN_USB_SignalRec_t rec;
+	rec.index = groups[g].index;
+	rec.time_us = time;
+	memcpy(out, &rec, sizeof(rec));
+	uint8_t len = sizeof(rec);
+
+	for (uint8_t i = groups[g].first; i != NO_SIGNAL; i = signals[i].next)
+	{
+		const Signal_t* s = &signals[i];
+		uint32_t v = ((s->motorola?motorola:intel) >> s->shift) & s->mask;
+		v = (v ^ s->sign) - s->sign;
+		memcpy(&out[len], &v, s->bytes);
+		len += s->bytes;
+	}
+
+	records++;
+	records_bytes += len;
+	frames_bytes += sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_Mess_t);
+	return len;
+}
+
+void signals_stat(CAN_USB_SignalStat_t* out)
+{
+	out->signals = signals_count;
+	out->ids = map.count;
+	out->capacity = SIGNALS_MAX;
+	out->records = records;
+	out->bytes_saved = (frames_bytes > records_bytes)?(frames_bytes - records_bytes):0;
+}
@@ -0,0 +1,26 @@
+/*
+ * signals.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef SIGNALS_H_
+#define SIGNALS_H_
+#include "proto.h"
+
+#define SIGNALS_MAX			64
+#define SIGNALS_BITS		7
+#define SIGNALS_VALUES_MAX	32		//value bytes per ID
+#define SIGNALS_RECORD_MAX	(sizeof(CAN_USB_SignalRec_t) + SIGNALS_VALUES_MAX)
+
+void signals_init();
+void signals_clear();
+uint8_t signals_add(const CAN_USB_Signal_t* sig);
+void signals_enable(uint8_t on);
+uint8_t signals_enabled();
+uint8_t signals_pass(const CAN_USB_Mess_t* mess);
+uint8_t signals_extract(const CAN_USB_Mess_t* mess, uint32_t time, uint8_t* out);
+void signals_stat(CAN_USB_SignalStat_t* out);
+
+#endif /* SIGNALS_H_ */
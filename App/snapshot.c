@@ -0,0 +1,135 @@
+/*
+ * snapshot.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "snapshot.h"
+#include "id_map.h"
+#include "rx_arena.h"
+#include "timebase.h"
+#include "board.h"
+#include <string.h>
+
+//! latest frame of an ID
+typedef struct
+{
+	CAN_USB_SnapEntry_t	entry;
+	uint32_t			gen;		//generation of the last update
+}Snap_Item_t;
+
+//! table, lives in the RX arena while the snapshot is on
+typedef struct
+{
+	uint32_t	map_keys[1 << SNAPSHOT_BITS];
+	uint16_t	map_items[1 << SNAPSHOT_BITS];
+	Snap_Item_t	items[SNAPSHOT_ITEMS];
+}Snap_Tables_t;
+
+_Static_assert(sizeof(Snap_Tables_t) <= RX_ARENA_SIZE, "snapshot tables don't fit the RX arena");
+
+static Snap_Tables_t* t = 0;
+static Id_Map_t map;
+static uint8_t mode = CAN_SNAP_OFF;
+static uint32_t gen = 0;
+static uint32_t scan_gen = 0;
+static uint32_t untracked = 0;
+
+//
+//Public members
+//
+void snapshot_init()
+{
+	t = 0;
+	memset(&map, 0, sizeof(map));
+	snapshot_set_mode(CAN_SNAP_OFF);
+}
+
+//
+//Any mode change starts an empty table. Returns 0 if the RX arena is
+//taken by another mode.
+//
+uint8_t snapshot_set_mode(uint8_t m)
+{
+	Snap_Tables_t* tables = 0;
+	if ((m != CAN_SNAP_OFF) && !(tables = rx_arena_take(RX_ARENA_SNAPSHOT)))
+		return 0;
+
+	__disable_irq();
+	mode = m;
+	gen = 0;
+	untracked = 0;
+	map.count = 0;
+	if (tables)
+	{
+		t = tables;
+		id_map_init(&map, t->map_keys, t->map_items, SNAPSHOT_BITS);
+	}
+	__enable_irq();
+
+	if (!tables) rx_arena_release(RX_ARENA_SNAPSHOT);
+	return 1;
+}
+
+uint8_t snapshot_mode()
+{
+	return mode;
+}
+
+//
+//Called from the RX ISR, 1 - the frame still goes to the stream.
+//IDs are added in arrival order and kept until the next mode change.
+//
+FAST_RUN uint8_t snapshot_update(const CAN_USB_Mess_t* mess, uint32_t now)
+{
+	if (mode == CAN_SNAP_OFF) return 1;
+
+	uint32_t key = ID_MAP_KEY(mess->id, mess->flags.ide);
+	uint16_t item = id_map_find(&map, key);
+	if (item == ID_MAP_NONE)
+	{
+		item = map.count;
+		if ((item >= SNAPSHOT_ITEMS) || !id_map_insert(&map, key, item))
+		{
+			untracked++;
+			return (mode == CAN_SNAP_ALSO);
+		}
+		t->items[item].entry.count = 0;
+	}
+
+	Snap_Item_t* it = &t->items[item];
+	it->entry.mess = *mess;
+	it->entry.time_us = now;
+	it->entry.count++;
+	it->gen = ++gen;
+
+	return (mode == CAN_SNAP_ALSO);
+}
+
+//
+//Copies up to max entries updated after since, starting at cursor.
+//Returns the cursor to continue with, 0 once the table is done.
+//All replies of one scan report the generation it started at.
+//
+uint16_t snapshot_read(uint32_t since, uint16_t cursor, CAN_USB_Snapshot_t* out, uint8_t max)
+{
+	if (!cursor) scan_gen = gen;
+
+	out->gen = scan_gen;
+	out->count = 0;
+	out->untracked = untracked;
+
+	uint16_t count = map.count;
+	while ((cursor < count) && (out->count < max))
+	{
+		__disable_irq();
+		if (t->items[cursor].gen > since)
+			out->entries[out->count++] = t->items[cursor].entry;
+		__enable_irq();
+		cursor++;
+	}
+
+	out->now_us = tb_us();
+	out->cursor = (cursor < count)?cursor:0;
+	return out->cursor;
+}
@@ -0,0 +1,22 @@
+/*
+ * snapshot.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+#include "proto.h"
+
+#define SNAPSHOT_BITS		8
+#define SNAPSHOT_ITEMS		((1 << SNAPSHOT_BITS)/2)
+#define SNAPSHOT_BATCH		((0xFF - sizeof(CAN_USB_Snapshot_t))/sizeof(CAN_USB_SnapEntry_t))
+
+void snapshot_init();
+uint8_t snapshot_set_mode(uint8_t mode);
+uint8_t snapshot_mode();
+uint8_t snapshot_update(const CAN_USB_Mess_t* mess, uint32_t now);
+uint16_t snapshot_read(uint32_t since, uint16_t cursor, CAN_USB_Snapshot_t* out, uint8_t max);
+
+#endif /* SNAPSHOT_H_ */
@@ -0,0 +1,32 @@
+/*
+ * timebase.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "timebase.h"
+#include "board.h"
+
+//
+//Microseconds from HAL tick and SysTick, wraps every 71.6 min.
+//Safe from ISRs which block SysTick: a pending reload counts as the next ms.
+//
+FAST_RUN uint32_t tb_us()
+{
+	uint32_t load = SysTick->LOAD + 1;
+	uint32_t ms, val;
+
+	do
+	{
+		ms = HAL_GetTick();
+		val = SysTick->VAL;
+	}while (ms != HAL_GetTick());
+
+	if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)
+	{
+		val = SysTick->VAL;
+		ms++;
+	}
+
+	return ms*1000 + ((load - 1 - val)*1000)/load;
+}
@@ -0,0 +1,14 @@
+/*
+ * timebase.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef TIMEBASE_H_
+#define TIMEBASE_H_
+#include <stdint.h>
+
+uint32_t tb_us();
+
+#endif /* TIMEBASE_H_ */
@@ -0,0 +1,284 @@
+/*
+ * tt_sched.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "tt_sched.h"
+#include "tx_sched.h"
+#include "busload.h"
+#include "app.h"
+#include "timebase.h"
+#include "board.h"
+#include <string.h>
+
+#define TT_NO_TIME			0xFFFFFFFF
+
+//! slot as set by the host, repeat 0 - unused
+typedef struct
+{
+	CAN_USB_Mess_t	mess;
+	uint32_t	offset;
+	uint8_t		base;
+	uint8_t		repeat;
+}TT_Slot_t;
+
+static TT_Slot_t slots[TT_SLOTS];
+static uint8_t order[TT_SLOTS];		//used slots by offset
+static uint8_t order_count = 0;
+static CAN_USB_TtConfig_t config;
+static uint32_t bitrate = 0;
+
+static volatile uint8_t state = CAN_TTS_OFF;
+static uint32_t cycle_start = 0;	//tb_us() of the reference SOF
+static uint8_t cycle = 0;
+static uint8_t next = 0;			//order[] index of the next slot in this cycle
+static uint32_t ref_time = TT_NO_TIME;	//TTCM timer at the reference SOF
+
+static uint32_t cycles = 0;
+static uint32_t misses = 0;
+static uint32_t ref_missed = 0;
+static uint16_t max_err = 0;
+
+//
+//Private forwards
+//
+static void new_cycle(uint32_t start, uint8_t count);
+static void arm(uint32_t us);
+
+//
+//Public members
+//
+void tt_init()
+{
+	memset(&config, 0, sizeof(config));
+	memset(slots, 0, sizeof(slots));
+	tt_stop();
+}
+
+void tt_stop()
+{
+	__disable_irq();
+	__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC3);
+	state = CAN_TTS_OFF;
+	__enable_irq();
+}
+
+//the schedule only changes while stopped
+uint8_t tt_config(const CAN_USB_TtConfig_t* cfg)
+{
+	if (state != CAN_TTS_OFF) return 0;
+	if (!cfg->cycle_us || !cfg->cycles || (cfg->cycles > 64) || (cfg->cycles & (cfg->cycles - 1))) return 0;
+
+	config = *cfg;
+	memset(slots, 0, sizeof(slots));
+	return 1;
+}
+
+uint8_t tt_slot(const CAN_USB_TtSlot_t* s)
+{
+	if (state != CAN_TTS_OFF) return 0;
+	if (s->slot >= TT_SLOTS) return 0;
+	if (s->repeat && ((s->repeat & (s->repeat - 1)) || (s->repeat > config.cycles) || (s->base >= s->repeat))) return 0;
+	if (s->offset_us >= config.cycle_us) return 0;
+
+	TT_Slot_t* t = &slots[s->slot];
+	t->mess = s->mess;
+	t->offset = s->offset_us;
+	t->base = s->base;
+	t->repeat = s->repeat;
+	return 1;
+}
+
+//
+//A master starts right away with its own reference message, a follower
+//waits for the first one from the bus.
+//
+uint8_t tt_start(uint32_t rate)
+{
+	if (!config.cycle_us || !rate) return 0;
+
+	order_count = 0;
+	for (uint8_t i = 0; i < TT_SLOTS; i++)
+	{
+		if (!slots[i].repeat) continue;
+		uint8_t j = order_count++;
+		for (; j && (slots[order[j - 1]].offset > slots[i].offset); j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	__disable_irq();
+	bitrate = rate;
+	cycles = misses = ref_missed = 0;
+	max_err = 0;
+	ref_time = TT_NO_TIME;
+	if (config.flags & CAN_TTF_MASTER)
+	{
+		//the first boundary is due now
+		state = CAN_TTS_RUN;
+		cycle_start = tb_us() - config.cycle_us;
+		cycle = config.cycles - 1;
+		next = order_count;
+		arm(0);
+	}
+	else
+		state = CAN_TTS_WAIT_REF;
+	__enable_irq();
+
+	return 1;
+}
+
+uint8_t tt_active()
+{
+	return state != CAN_TTS_OFF;
+}
+
+//
+//TIM2 channel 3: slots go to a mailbox at their offsets from the cycle
+//start. At the cycle end a master sends the next reference message, a
+//follower waits for it up to window_us and then free-runs one cycle.
+//
+FAST_RUN void tt_run()
+{
+	if (state != CAN_TTS_RUN)
+	{
+		__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC3);
+		return;
+	}
+
+	uint32_t now = tb_us();
+	for (;;)
+	{
+		if (next >= order_count)
+		{
+			uint8_t master = (config.flags & CAN_TTF_MASTER)?1:0;
+			uint32_t due = cycle_start + config.cycle_us + (master?0:config.window_us);
+			int32_t left = due - now;
+			if (left > 0)
+			{
+				arm(left);
+				return;
+			}
+
+			if (!master) ref_missed++;
+			new_cycle(cycle_start + config.cycle_us, (cycle + 1) & (config.cycles - 1));
+			if (master)
+			{
+				CAN_USB_Mess_t ref;
+				memset(&ref, 0, sizeof(ref));
+				ref.id = config.ref_id;
+				ref.flags.ide = (config.flags & CAN_TTF_REF_IDE)?1:0;
+				ref.flags.dlc = 1;
+				ref.data[0] = cycle;
+				if (!app_can_send(&ref, TT_TAG_REF)) misses++;
+			}
+			continue;
+		}
+
+		uint8_t i = order[next];
+		int32_t left = (cycle_start + slots[i].offset) - now;
+		if (left > 0)
+		{
+			arm(left);
+			return;
+		}
+
+		next++;
+		if ((cycle & (slots[i].repeat - 1)) != slots[i].base) continue;
+		if (!app_can_send(&slots[i].mess, i + 1)) misses++;
+	}
+}
+
+//
+//Reference message from the bus: the cycle restarts at its SOF, estimated
+//from the reception time minus the frame length, and the cycle count is
+//taken from the first data byte as in TTCAN.
+//
+FAST_RUN void tt_rx(const CAN_USB_Mess_t* mess, uint16_t hw_time, uint32_t now)
+{
+	if ((state == CAN_TTS_OFF) || (config.flags & CAN_TTF_MASTER)) return;
+	if ((mess->id != config.ref_id) || (mess->flags.ide != ((config.flags & CAN_TTF_REF_IDE)?1:0))) return;
+
+	//slots of the old cycle that didn't come up in time
+	for (; (state == CAN_TTS_RUN) && (next < order_count); next++)
+		if ((cycle & (slots[order[next]].repeat - 1)) == slots[order[next]].base) misses++;
+
+	uint16_t bits = busload_frame_bits(mess->id, mess->flags.ide, mess->flags.rtr, mess->flags.dlc, mess->data);
+	new_cycle(now - ((uint64_t)bits*1000000)/bitrate, (mess->data[0] & 0x3F) & (config.cycles - 1));
+	ref_time = hw_time;
+	state = CAN_TTS_RUN;
+	arm(0);
+}
+
+//
+//TTCM stamps the SOF of every frame with the same bit timer: a slot is
+//checked against the reference message of its cycle, in bit times.
+//
+FAST_RUN void tt_tx_done(uint8_t tag, uint8_t ok, uint16_t hw_time)
+{
+	if (tag == TT_TAG_REF)
+	{
+		if (ok) ref_time = hw_time;
+		else misses++;
+		return;
+	}
+
+	if (!ok)
+	{
+		misses++;
+		return;
+	}
+	if ((ref_time == TT_NO_TIME) || !bitrate) return;
+
+	uint32_t expected = ((uint64_t)slots[tag - 1].offset*bitrate)/1000000;
+	if (expected > 0xFFFF) return;	//beyond one timer wrap
+
+	int32_t err = (int32_t)((uint16_t)(hw_time - ref_time)) - (int32_t)expected;
+	uint32_t err_us = ((uint64_t)((err < 0)?-err:err)*1000000)/bitrate;
+	if (err_us > max_err) max_err = (err_us > 0xFFFF)?0xFFFF:err_us;
+	if (err_us > config.window_us) misses++;
+}
+
+void tt_stat(CAN_USB_TtStat_t* out)
+{
+	out->state = state;
+	out->slots = order_count;
+	out->cycle = cycle;
+	out->cycles = cycles;
+	out->misses = misses;
+	out->ref_missed = ref_missed;
+	out->max_err_us = max_err;
+	max_err = 0;
+}
+
+uint32_t tt_cycles()
+{
+	return cycles;
+}
+
+uint32_t tt_misses()
+{
+	return misses;
+}
+
+//
+//Private members
+//
+static FAST_RUN void new_cycle(uint32_t start, uint8_t count)
+{
+	cycle_start = start;
+	cycle = count;
+	next = 0;
+	ref_time = TT_NO_TIME;
+	cycles++;
+}
+
+static FAST_RUN void arm(uint32_t us)
+{
+	if (us > TX_SCHED_MAX_WAIT) us = TX_SCHED_MAX_WAIT;
+	if (us < 2) us = 2;
+	__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_3, (__HAL_TIM_GET_COUNTER(&htim2) + us) & 0xFFFF);
+	__HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_CC3);
+	__HAL_TIM_ENABLE_IT(&htim2, TIM_IT_CC3);
+}
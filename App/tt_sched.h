@@ -0,0 +1,28 @@
+/*
+ * tt_sched.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef TT_SCHED_H_
+#define TT_SCHED_H_
+#include "proto.h"
+
+#define TT_SLOTS			16
+#define TT_TAG_REF			0x80		//app_can_send() tag of the reference message, slots are 1..TT_SLOTS
+
+void tt_init();
+void tt_stop();
+uint8_t tt_config(const CAN_USB_TtConfig_t* cfg);
+uint8_t tt_slot(const CAN_USB_TtSlot_t* s);
+uint8_t tt_start(uint32_t bitrate);
+uint8_t tt_active();
+void tt_run();
+void tt_rx(const CAN_USB_Mess_t* mess, uint16_t hw_time, uint32_t now);
+void tt_tx_done(uint8_t tag, uint8_t ok, uint16_t hw_time);
+void tt_stat(CAN_USB_TtStat_t* out);
+uint32_t tt_cycles();
+uint32_t tt_misses();
+
+#endif /* TT_SCHED_H_ */
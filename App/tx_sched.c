@@ -0,0 +1,315 @@
+/*
+ * tx_sched.c
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+#include "tx_sched.h"
+#include "tt_sched.h"
+#include "isotp.h"
+#include "app.h"
+#include "timebase.h"
+#include "board.h"
+#include <string.h>
+
+//! periodic slot, due is tb_us() of the next transmission
+typedef struct
+{
+	CAN_USB_Mess_t	mess;
+	uint32_t	period;
+	uint32_t	due;
+	uint8_t		active;
+}Sched_Slot_t;
+
+static Sched_Slot_t slots[TX_SCHED_SLOTS];
+static uint8_t active = 0;
+static uint32_t epoch = 0;
+static uint32_t sent = 0;
+static uint32_t deferred = 0;
+static uint32_t skipped = 0;
+static uint32_t late_max = 0;
+
+//timed queue: filled by the main loop, emptied by the TIM2 channel 2 compare
+static CAN_USB_Timed_t timed[TX_TIMED_SIZE];
+static uint16_t timed_head = 0;
+static volatile uint16_t timed_tail = 0;
+static volatile uint8_t timed_low = 0;
+static uint32_t timed_sent = 0;
+static uint32_t timed_late = 0;
+static uint32_t timed_late_max = 0;
+static uint32_t timed_dropped = 0;
+
+//
+//Private forwards
+//
+static void arm(uint32_t channel, uint32_t us);
+static void run_periodic();
+static void run_timed();
+
+//
+//Public members
+//
+void tx_sched_init()
+{
+	tx_sched_clear();
+	tx_timed_flush();
+	HAL_TIM_Base_Start(&htim2);
+}
+
+void tx_sched_clear()
+{
+	__disable_irq();
+	__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC1);
+	memset(slots, 0, sizeof(slots));
+	active = 0;
+	epoch = tb_us();
+	sent = deferred = skipped = late_max = 0;
+	__enable_irq();
+}
+
+//
+//A new slot starts at the next point of its phase grid, so slots set one
+//by one keep the offsets the host asked for.
+//
+uint8_t tx_sched_set(const CAN_USB_Periodic_t* p)
+{
+	if (p->op == CAN_PERIODIC_CLEAR)
+	{
+		tx_sched_clear();
+		return 1;
+	}
+	if (p->slot >= TX_SCHED_SLOTS) return 0;
+
+	Sched_Slot_t* s = &slots[p->slot];
+	switch(p->op)
+	{
+		case CAN_PERIODIC_SET:
+		{
+			if (p->period_us < TX_SCHED_MIN_PERIOD) return 0;
+
+			__disable_irq();
+			uint32_t now = tb_us();
+			s->mess = p->mess;
+			s->period = p->period_us;
+			s->due = now + s->period - (now - epoch + s->period - p->phase_us % s->period) % s->period;
+			if (!s->active) active++;
+			s->active = 1;
+			arm(TIM_CHANNEL_1, 0);
+			__enable_irq();
+			return 1;
+		}
+		case CAN_PERIODIC_DATA:
+		{
+			if (!s->active) return 0;
+
+			__disable_irq();
+			s->mess.flags.dlc = p->mess.flags.dlc;
+			memcpy(s->mess.data, p->mess.data, sizeof(s->mess.data));
+			__enable_irq();
+			return 1;
+		}
+		case CAN_PERIODIC_STOP:
+		{
+			__disable_irq();
+			if (s->active) active--;
+			s->active = 0;
+			__enable_irq();
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+//slots or queued frames: both need a mailbox kept free of host frames
+uint8_t tx_sched_active()
+{
+	return active || (timed_head != timed_tail);
+}
+
+void tx_sched_stat(CAN_USB_PeriodicStat_t* out)
+{
+	out->active = active;
+	out->capacity = TX_SCHED_SLOTS;
+	out->sent = sent;
+	out->deferred = deferred;
+	out->skipped = skipped;
+	out->late_max_us = late_max;
+	late_max = 0;
+}
+
+void tx_timed_flush()
+{
+	__disable_irq();
+	__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC2);
+	timed_head = timed_tail = 0;
+	timed_low = 0;
+	timed_sent = timed_late = timed_late_max = timed_dropped = 0;
+	__enable_irq();
+}
+
+//
+//Frames are sent in the order they were added, a deadline earlier than
+//the one before it just goes out right after that frame.
+//
+uint8_t tx_timed_add(const CAN_USB_Timed_t* t)
+{
+	uint16_t next = (timed_head + 1) & (TX_TIMED_SIZE - 1);
+	if (next == timed_tail)
+	{
+		timed_dropped++;
+		return 0;
+	}
+
+	timed[timed_head] = *t;
+	__disable_irq();
+	uint8_t idle = (timed_head == timed_tail);
+	timed_head = next;
+	if (idle)
+		arm(TIM_CHANNEL_2, 0);
+	__enable_irq();
+
+	return 1;
+}
+
+//set once when the queue drains to half, cleared by reading
+uint8_t tx_timed_low()
+{
+	if (!timed_low) return 0;
+	timed_low = 0;
+	return 1;
+}
+
+void tx_timed_stat(CAN_USB_TimedStat_t* out)
+{
+	uint16_t queued = (timed_head - timed_tail) & (TX_TIMED_SIZE - 1);
+	out->now_us = tb_us();
+	out->queued = queued;
+	out->free = TX_TIMED_SIZE - 1 - queued;
+	out->sent = timed_sent;
+	out->late = timed_late;
+	out->late_max_us = timed_late_max;
+	out->dropped = timed_dropped;
+	timed_late_max = 0;
+}
+
+FAST_RUN void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
+{
+	if (htim != &htim2) return;
+
+	if (htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1)
+		run_periodic();
+	else if (htim->Channel == HAL_TIM_ACTIVE_CHANNEL_2)
+		run_timed();
+	else if (htim->Channel == HAL_TIM_ACTIVE_CHANNEL_3)
+		tt_run();
+	else if (htim->Channel == HAL_TIM_ACTIVE_CHANNEL_4)
+		isotp_run();
+}
+
+//
+//Private members
+//
+
+//
+//Every due slot goes to a mailbox, then the compare is set to the earliest
+//next due time. A slot that found no mailbox is retried shortly, one that
+//fell a whole period behind skips to its next grid point.
+//
+static FAST_RUN void run_periodic()
+{
+	if (!active)
+	{
+		__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC1);
+		return;
+	}
+
+	uint32_t now = tb_us();
+	uint32_t wait = TX_SCHED_MAX_WAIT;
+	for (uint8_t i = 0; i < TX_SCHED_SLOTS; i++)
+	{
+		Sched_Slot_t* s = &slots[i];
+		if (!s->active) continue;
+
+		int32_t left = s->due - now;
+		if (left <= 0)
+		{
+			if (!app_can_send(&s->mess, 0))
+			{
+				deferred++;
+				//an earlier slot may be due sooner than the retry
+				if (TX_SCHED_RETRY < wait) wait = TX_SCHED_RETRY;
+				continue;
+			}
+			sent++;
+			if ((uint32_t)-left > late_max) late_max = -left;
+
+			s->due += s->period;
+			left = s->due - now;
+			if (left <= 0)
+			{
+				uint32_t lost = (uint32_t)-left/s->period + 1;
+				skipped += lost;
+				s->due += lost*s->period;
+				left = s->due - now;
+			}
+		}
+		if ((uint32_t)left < wait) wait = left;
+	}
+
+	arm(TIM_CHANNEL_1, wait);
+}
+
+//
+//Frames whose deadline has come are sent back to back, the compare then
+//waits for the next one. A deadline in the past counts as due.
+//
+static FAST_RUN void run_timed()
+{
+	uint16_t tail = timed_tail;
+	while (tail != timed_head)
+	{
+		uint32_t now = tb_us();
+		int32_t left = timed[tail].time_us - now;
+		if (left > 0)
+		{
+			arm(TIM_CHANNEL_2, ((uint32_t)left < TX_SCHED_MAX_WAIT)?left:TX_SCHED_MAX_WAIT);
+			break;
+		}
+
+		if (!app_can_send(&timed[tail].mess, 0))
+		{
+			arm(TIM_CHANNEL_2, TX_SCHED_RETRY);
+			break;
+		}
+		timed_sent++;
+		if (-left > TX_TIMED_LATE) timed_late++;
+		if ((uint32_t)-left > timed_late_max) timed_late_max = -left;
+
+		tail = (tail + 1) & (TX_TIMED_SIZE - 1);
+		timed_tail = tail;
+		if (((timed_head - tail) & (TX_TIMED_SIZE - 1)) == TX_TIMED_SIZE/2)
+			timed_low = 1;
+	}
+
+	if (tail == timed_head)
+		__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC2);
+}
+
+//the counter runs at 1 MHz, a compare in the past would only fire after a wrap
+static FAST_RUN void arm(uint32_t channel, uint32_t us)
+{
+	if (us < 2) us = 2;
+	uint32_t ccr = (__HAL_TIM_GET_COUNTER(&htim2) + us) & 0xFFFF;
+	__HAL_TIM_SET_COMPARE(&htim2, channel, ccr);
+	if (channel == TIM_CHANNEL_1)
+	{
+		__HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_CC1);
+		__HAL_TIM_ENABLE_IT(&htim2, TIM_IT_CC1);
+	}
+	else
+	{
+		__HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_CC2);
+		__HAL_TIM_ENABLE_IT(&htim2, TIM_IT_CC2);
+	}
+}
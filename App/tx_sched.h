@@ -0,0 +1,29 @@
+/*
+ * tx_sched.h
+ *
+ *  Created on: 19 . 2026 .
+ *      Author: Rem Norton
+ */
+
+#ifndef TX_SCHED_H_
+#define TX_SCHED_H_
+#include "proto.h"
+
+#define TX_SCHED_SLOTS			32
+#define TX_SCHED_MIN_PERIOD		100			//us
+#define TX_SCHED_RETRY			50			//us, next try when no mailbox was free
+#define TX_SCHED_MAX_WAIT		50000		//us, within the 16 bit timer range
+#define TX_TIMED_SIZE			64			//power of 2
+#define TX_TIMED_LATE			10			//us
+
+void tx_sched_init();
+void tx_sched_clear();
+uint8_t tx_sched_set(const CAN_USB_Periodic_t* p);
+uint8_t tx_sched_active();
+void tx_sched_stat(CAN_USB_PeriodicStat_t* out);
+void tx_timed_flush();
+uint8_t tx_timed_add(const CAN_USB_Timed_t* t);
+uint8_t tx_timed_low();
+void tx_timed_stat(CAN_USB_TimedStat_t* out);
+
+#endif /* TX_SCHED_H_ */
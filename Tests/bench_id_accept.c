@@ -0,0 +1,68 @@
+/*
+ * bench_id_accept.c
+ *
+ *  Created on: 19 окт. 2026 г.
+ *      Author: Rem Norton
+ */
+#include "id_accept.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICKS()		__rdtsc()
+#define TICK_NAME	"TSC cycles"
+#else
+#define TICKS()		((uint64_t)clock())
+#define TICK_NAME	"clock ticks"
+#endif
+
+#define STD_IDS		150
+#define EXT_IDS		200
+#define LOOKUPS		1000000
+
+//
+//The setup of the user-031 numbers: 150 standard and 200 extended IDs plus
+//two wide ranges, 1M lookups, 25% extended and half of those misses.
+//
+int main()
+{
+	static uint32_t id[LOOKUPS];
+	static uint8_t ide[LOOKUPS];
+	uint32_t ext[EXT_IDS];
+
+	srand(31);
+	id_accept_clear();
+	for (uint16_t i = 0; i < STD_IDS; i++)
+		id_accept_add(rand() & 0x7FF, 0x7FF, 0);
+	for (uint16_t i = 0; i < EXT_IDS; i++)
+	{
+		ext[i] = (((uint32_t)rand() << 12) ^ rand()) & 0x1FFFFFFF;
+		id_accept_add(ext[i], 0x1FFFFFFF, 1);
+	}
+	id_accept_add(0x18DA0000, 0x1FFF0000, 1);
+	id_accept_add(0x18DB0000, 0x1FFF0000, 1);
+	if (!id_accept_commit())
+	{
+		printf("bench_id_accept: set refused\n");
+		return 1;
+	}
+	id_accept_enable(1);
+
+	for (uint32_t i = 0; i < LOOKUPS; i++)
+	{
+		ide[i] = ((rand() & 3) == 0);
+		if (!ide[i]) id[i] = rand() & 0x7FF;
+		else if (rand() & 1) id[i] = ext[rand() % EXT_IDS];
+		else id[i] = (((uint32_t)rand() << 12) ^ rand()) & 0x1FFFFFFF;
+	}
+
+	uint32_t hits = 0;
+	uint64_t t0 = TICKS();
+	for (uint32_t i = 0; i < LOOKUPS; i++)
+		hits += id_accept(id[i], ide[i]);
+	uint64_t t1 = TICKS();
+
+	printf("bench_id_accept: %u lookups, %u accepted, %.1f %s per frame\n", LOOKUPS, hits, (double)(t1 - t0)/LOOKUPS, TICK_NAME);
+	return 0;
+}
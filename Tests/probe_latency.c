@@ -0,0 +1,201 @@
+/*
+ * probe_latency.c
+ *
+ *  Created on: 19 окт. 2026 г.
+ *      Author: Rem Norton
+ */
+#include "proto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+
+#define RUN_MS		2000
+#define PRIO_ID		0x010
+#define PRIO_EVERY	50			//one lane frame per N bulk frames
+
+static int fd = -1;
+static uint8_t in_buf[4096];
+static uint16_t in_len = 0;
+static CAN_USB_Status_t status;
+static uint8_t status_seen = 0;
+static uint32_t rx_bulk = 0;
+static uint32_t rx_prio = 0;
+
+//
+//Private forwards
+//
+static void send_pck(uint8_t type, const void* data, uint8_t len);
+static void drain();
+static uint64_t now_us();
+static uint8_t get_status();
+
+//
+//Device latency under load, run against the board in silent loopback:
+//every frame sent comes back, FIFO0 for the bulk IDs, FIFO1 for PRIO_ID.
+//Per rate it prints the status figures of that run: ISR to USB p99 of
+//both RX lanes and the USB to bus p50/p99/max of the sent frames.
+//usage: probe_latency /dev/ttyACM0 [frames/s ...]
+//
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("usage: %s <tty> [frames/s ...]\n", argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[1], O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	struct termios tio;
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(fd, TCSANOW, &tio);
+
+	CAN_USB_Option_t opt = {CAN_OPT_STATUS_PERIOD, 0};
+	send_pck(CAN_PT_OPTION, &opt, sizeof(opt));
+	CAN_USB_Baud_t baud = {CAN_BAUD_500, CAN_OPMODE_SILENT_LOOPBACK};
+	send_pck(CAN_PT_BAUD, &baud, sizeof(baud));
+
+	//lane ID to FIFO1, every other standard data frame to FIFO0
+	uint8_t fl[1 + 2*sizeof(CAN_USB_FilterEntry_t)];
+	CAN_USB_FilterListCmd_t* cmd = (CAN_USB_FilterListCmd_t*)fl;
+	cmd->op = CAN_FLIST_CLEAR;
+	send_pck(CAN_PT_FILTER_LIST, fl, 1);
+	cmd->op = CAN_FLIST_ADD;
+	cmd->entries[0] = (CAN_USB_FilterEntry_t){PRIO_ID, 0x7FF, CAN_FENTRY_PRIO};
+	cmd->entries[1] = (CAN_USB_FilterEntry_t){0, 0, 0};
+	send_pck(CAN_PT_FILTER_LIST, fl, sizeof(fl));
+	cmd->op = CAN_FLIST_APPLY;
+	send_pck(CAN_PT_FILTER_LIST, fl, 1);
+
+	printf("%8s %8s %8s %10s %10s %8s %8s %8s %8s\n", "fps", "rx", "prio_rx", "bulk_p99", "prio_p99", "tx_p50", "tx_p99", "tx_max", "overrun");
+	for (int a = 2; a < ((argc > 2)?argc:3); a++)
+	{
+		uint32_t rate = (argc > 2)?strtoul(argv[a], 0, 0):2000;
+
+		//a status request starts the measurement window
+		if (!get_status())
+		{
+			printf("no status reply\n");
+			return 1;
+		}
+		uint32_t overruns = status.rx_overruns;
+		rx_bulk = rx_prio = 0;
+
+		uint64_t start = now_us();
+		uint32_t sent = 0;
+		while ((now_us() - start) < RUN_MS*1000ULL)
+		{
+			uint32_t due = (now_us() - start)*rate/1000000;
+			for (; sent < due; sent++)
+			{
+				CAN_USB_Mess_t m;
+				memset(&m, 0, sizeof(m));
+				m.id = (sent % PRIO_EVERY)?(0x100 + sent % 64):PRIO_ID;
+				m.flags.dlc = 8;
+				memcpy(m.data, &sent, sizeof(sent));
+				send_pck(CAN_PT_MESS, &m, sizeof(m));
+			}
+			drain();
+			usleep(200);
+		}
+
+		usleep(100000);
+		if (!get_status())
+		{
+			printf("no status reply\n");
+			return 1;
+		}
+		printf("%8u %8u %8u %10u %10u %8u %8u %8u %8u\n", rate, rx_bulk, rx_prio, status.bulk_p99_us, status.prio_p99_us,
+				status.tx_p50_us, status.tx_p99_us, status.tx_max_us, status.rx_overruns - overruns);
+	}
+
+	close(fd);
+	return 0;
+}
+
+//
+//Private members
+//
+static void send_pck(uint8_t type, const void* data, uint8_t len)
+{
+	uint8_t out[sizeof(CAN_USB_Header_t) + 0xFF];
+	CAN_USB_Header_t* hdr = (CAN_USB_Header_t*)out;
+	hdr->prefix = _PREFIX_;
+	hdr->type = type;
+	hdr->datalen = len;
+	memcpy(&out[sizeof(CAN_USB_Header_t)], data, len);
+
+	uint16_t pos = 0;
+	uint16_t total = sizeof(CAN_USB_Header_t) + len;
+	while (pos < total)
+	{
+		ssize_t n = write(fd, &out[pos], total - pos);
+		if (n > 0) pos += n;
+		else usleep(100);
+	}
+}
+
+//reads whatever is pending, counts frames, keeps the last status
+static void drain()
+{
+	ssize_t n;
+	while ((n = read(fd, &in_buf[in_len], sizeof(in_buf) - in_len)) > 0)
+	{
+		in_len += n;
+		uint16_t pos = 0;
+		while ((uint16_t)(in_len - pos) >= sizeof(CAN_USB_Header_t))
+		{
+			CAN_USB_Header_t* hdr = (CAN_USB_Header_t*)&in_buf[pos];
+			if (hdr->prefix != _PREFIX_)
+			{
+				pos++;
+				continue;
+			}
+			if ((uint16_t)(in_len - pos) < (sizeof(CAN_USB_Header_t) + hdr->datalen)) break;
+
+			uint8_t* payload = &in_buf[pos + sizeof(CAN_USB_Header_t)];
+			if ((hdr->type == CAN_PT_MESS) && (hdr->datalen >= sizeof(CAN_USB_Mess_t)))
+			{
+				if (((CAN_USB_Mess_t*)payload)->id == PRIO_ID) rx_prio++;
+				else rx_bulk++;
+			}
+			else if ((hdr->type == CAN_PT_STATUS) && (hdr->datalen >= sizeof(CAN_USB_Status_t)))
+			{
+				memcpy(&status, payload, sizeof(status));
+				status_seen = 1;
+			}
+			pos += sizeof(CAN_USB_Header_t) + hdr->datalen;
+		}
+		memmove(in_buf, &in_buf[pos], in_len - pos);
+		in_len -= pos;
+	}
+}
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static uint8_t get_status()
+{
+	status_seen = 0;
+	send_pck(CAN_PT_STATUS, 0, 0);
+	uint64_t start = now_us();
+	while (!status_seen && ((now_us() - start) < 1000000))
+	{
+		drain();
+		usleep(1000);
+	}
+	return status_seen;
+}
@@ -0,0 +1,130 @@
+/*
+ * test_busload.c
+ *
+ *  Created on: 19 окт. 2026 г.
+ *      Author: Rem Norton
+ */
+#include "busload.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FRAMES		200000
+
+static uint8_t bits[160];
+static uint16_t nbits;
+
+//
+//Private forwards
+//
+static void put(uint32_t v, uint8_t n);
+static uint16_t reference_bits(uint32_t id, uint8_t ide, uint8_t rtr, uint8_t dlc, const uint8_t* data);
+
+//
+//Every frame is built bit by bit, CRC15 and stuffing are counted on the
+//bit string and compared with the table driven busload_frame_bits().
+//
+int main()
+{
+	busload_init();
+	srand(12345);
+
+	uint32_t fails = 0;
+	for (uint32_t i = 0; i < FRAMES; i++)
+	{
+		uint8_t ide = rand() & 1;
+		uint8_t rtr = ((rand() & 7) == 0);
+		uint8_t dlc = rand() % 16;
+		uint32_t id = ((uint32_t)rand() << 8) ^ rand();
+		id &= ide?0x1FFFFFFF:0x7FF;
+
+		uint8_t data[8];
+		//runs of equal bits are where stuffing goes wrong
+		uint8_t fill = rand() % 4;
+		for (uint8_t b = 0; b < 8; b++)
+			data[b] = (fill == 0)?0x00:((fill == 1)?0xFF:rand());
+
+		uint16_t got = busload_frame_bits(id, ide, rtr, dlc, data);
+		uint16_t want = reference_bits(id, ide, rtr, dlc, data);
+		if (got != want)
+		{
+			if (fails++ < 10)
+				printf("busload: id %08X ide %u rtr %u dlc %u: %u bits, reference %u\n", id, ide, rtr, dlc, got, want);
+		}
+	}
+
+	//a classic worst case: 8 zero bytes, standard ID 0
+	uint8_t zero[8] = {0};
+	if (busload_frame_bits(0, 0, 0, 8, zero) != reference_bits(0, 0, 0, 8, zero))
+		fails++;
+
+	printf("test_busload: %u frames, %u mismatches\n", FRAMES, fails);
+	return fails?1:0;
+}
+
+//
+//Private members
+//
+static void put(uint32_t v, uint8_t n)
+{
+	while (n--)
+		bits[nbits++] = (v >> n) & 1;
+}
+
+static uint16_t reference_bits(uint32_t id, uint8_t ide, uint8_t rtr, uint8_t dlc, const uint8_t* data)
+{
+	uint8_t len = rtr?0:((dlc > 8)?8:dlc);
+	nbits = 0;
+
+	put(0, 1);
+	if (ide)
+	{
+		put(id >> 18, 11);
+		put(1, 1);				//SRR
+		put(1, 1);				//IDE
+		put(id & 0x3FFFF, 18);
+		put(rtr, 1);
+		put(0, 2);				//r1, r0
+	}
+	else
+	{
+		put(id, 11);
+		put(rtr, 1);
+		put(0, 2);				//IDE, r0
+	}
+	put(dlc, 4);
+	for (uint8_t i = 0; i < len; i++)
+		put(data[i], 8);
+
+	uint16_t crc = 0;
+	for (uint16_t i = 0; i < nbits; i++)
+	{
+		uint8_t next = bits[i] ^ ((crc >> 14) & 1);
+		crc = (crc << 1) & 0x7FFF;
+		if (next) crc ^= 0x4599;
+	}
+	put(crc, 15);
+
+	uint16_t stuffs = 0;
+	uint8_t run = 1;
+	uint8_t last = bits[0];
+	for (uint16_t i = 1; i < nbits; i++)
+	{
+		if (bits[i] == last)
+		{
+			if (++run == 5)
+			{
+				//the stuff bit is the complement and starts a new run
+				stuffs++;
+				last ^= 1;
+				run = 1;
+			}
+		}
+		else
+		{
+			last = bits[i];
+			run = 1;
+		}
+	}
+
+	return nbits + stuffs + 13;
+}
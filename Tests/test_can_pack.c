@@ -0,0 +1,141 @@
+/*
+ * test_can_pack.c
+ *
+ *  Created on: 19 окт. 2026 г.
+ *      Author: Rem Norton
+ */
+#include "rx_pack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(c)	do { if (!(c)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #c); fails++; } } while (0)
+
+#define KEY_EVERY	32
+#define RUN_MS		10000
+#define MAX_IDS		400
+
+//! synthetic bus node: counter in byte 0, checksum in byte 7, slow signal in 1..2
+typedef struct
+{
+	CAN_USB_Mess_t	mess;
+	uint16_t		period;
+	uint16_t		phase;
+	uint16_t		slow;
+}Node_t;
+
+static uint32_t fails = 0;
+static Node_t nodes[MAX_IDS];
+
+//
+//Private members
+//
+static void make_nodes(uint16_t count)
+{
+	static const uint16_t periods[] = {10, 20, 100};
+	for (uint16_t i = 0; i < count; i++)
+	{
+		Node_t* n = &nodes[i];
+		memset(n, 0, sizeof(Node_t));
+		n->mess.flags.ide = (i % 5) == 0;
+		n->mess.id = n->mess.flags.ide?(0x18FF0000 | i):(0x100 + i);
+		n->mess.flags.dlc = 8;
+		for (uint8_t b = 0; b < 8; b++)
+			n->mess.data[b] = rand();
+		n->period = periods[i % 3];
+		n->phase = rand() % n->period;
+		n->slow = 500 + rand() % 1000;
+	}
+}
+
+static void step(Node_t* n, uint32_t t)
+{
+	uint8_t* d = n->mess.data;
+	d[0] = (d[0] & 0xF0) | ((d[0] + 1) & 0x0F);
+	if (!(t % n->slow))
+	{
+		d[1] += 1 + rand() % 3;
+		d[2] ^= 1 << (rand() % 8);
+	}
+	d[7] = 0;
+	for (uint8_t b = 0; b < 7; b++)
+		d[7] ^= d[b];
+}
+
+//Runs count nodes through the device encoder and a host decoder, decoder
+//joins at join_ms with an empty dictionary. Returns USB bytes per frame.
+static double run(uint16_t count, uint32_t join_ms)
+{
+	static Can_Pack_Slot_t host[CAN_PACK_SLOTS];
+	uint8_t rec[RX_PACK_RECORD_MAX];
+	uint32_t frames = 0;
+	uint32_t bytes = 0;
+	uint32_t missed = 0;
+
+	srand(count);
+	make_nodes(count);
+	rx_pack_init();
+	rx_pack_set(KEY_EVERY);
+	can_pack_reset(host);
+
+	for (uint32_t t = 0; t < RUN_MS; t++)
+	{
+		for (uint16_t i = 0; i < count; i++)
+		{
+			Node_t* n = &nodes[i];
+			if ((t % n->period) != n->phase) continue;
+			step(n, t);
+
+			uint8_t len = rx_pack_frame(&n->mess, rec);
+			CHECK(len && (len <= RX_PACK_RECORD_MAX));
+			frames++;
+			bytes += len;
+			if (t < join_ms) continue;
+
+			uint8_t pos = 0;
+			uint8_t got = 0;
+			CAN_USB_Mess_t out;
+			while (pos < len)
+			{
+				uint8_t valid;
+				uint8_t used = can_unpack_record(host, &rec[pos], len - pos, &out, &valid);
+				CHECK(used);
+				if (!used) break;
+				pos += used;
+				got |= valid;
+			}
+
+			if (!got)
+			{
+				//a late decoder may miss a slot until its next keyframe
+				CHECK(join_ms);
+				missed++;
+				continue;
+			}
+			CHECK(!memcmp(&out, &n->mess, sizeof(CAN_USB_Mess_t)));
+		}
+	}
+
+	//every slot is keyed again within KEY_EVERY + 1 frames of its ID
+	CHECK(missed <= (uint32_t)count*(KEY_EVERY + 1));
+	return (double)bytes/frames;
+}
+
+int main()
+{
+	const double plain = sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_Mess_t);
+
+	double b = run(150, 0);
+	printf("150 IDs, N=%d: %.1f bytes/frame vs %.0f plain (%.1fx)\n", KEY_EVERY, b, plain, plain/b);
+	CHECK(b < plain/3);
+
+	b = run(150, 1234);
+	printf("150 IDs, late decoder: %.1f bytes/frame\n", b);
+
+	b = run(400, 0);
+	printf("400 IDs, N=%d: %.1f bytes/frame vs %.0f plain (%.1fx)\n", KEY_EVERY, b, plain, plain/b);
+	CHECK(b < plain);
+
+	printf("test_can_pack: %u failures\n", fails);
+	return fails?1:0;
+}
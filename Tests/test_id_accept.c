@@ -0,0 +1,72 @@
+/*
+ * test_id_accept.c
+ *
+ *  Created on: 19 окт. 2026 г.
+ *      Author: Rem Norton
+ */
+#include "id_accept.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(c)	do { if (!(c)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #c); fails++; } } while (0)
+
+static uint32_t fails = 0;
+
+int main()
+{
+	//standard bitmap: an entry with don't care bits covers exactly its IDs
+	id_accept_clear();
+	CHECK(id_accept_add(0x120, 0x7F0, 0));
+	CHECK(id_accept_commit());
+	id_accept_enable(1);
+	for (uint32_t id = 0; id < 0x800; id++)
+		CHECK(id_accept(id, 0) == ((id & 0x7F0) == 0x120));
+
+	//extended set filled to its limit: every ID is found, nothing else is
+	id_accept_clear();
+	uint32_t ids[ID_ACCEPT_EXT_MAX];
+	srand(7);
+	for (uint16_t i = 0; i < ID_ACCEPT_EXT_MAX; i++)
+	{
+		ids[i] = (((uint32_t)rand() << 12) ^ rand()) & 0x1FFFFFFF;
+		CHECK(id_accept_add(ids[i], 0x1FFFFFFF, 1));
+	}
+	CHECK(!id_accept_rejected());
+	CHECK(id_accept_commit());
+	for (uint16_t i = 0; i < ID_ACCEPT_EXT_MAX; i++)
+		CHECK(id_accept(ids[i], 1));
+	uint32_t false_hits = 0;
+	for (uint32_t i = 0; i < 100000; i++)
+	{
+		uint32_t id = (((uint32_t)rand() << 12) ^ rand()) & 0x1FFFFFFF;
+		uint8_t known = 0;
+		for (uint16_t k = 0; k < ID_ACCEPT_EXT_MAX; k++)
+			known |= (ids[k] == id);
+		if (!known && id_accept(id, 1)) false_hits++;
+	}
+	CHECK(!false_hits);
+
+	//64 more IDs don't fit: the add fails and the list can't go live
+	CHECK(!id_accept_add(0x00000001, 0x1FFFFFC0, 1));
+	CHECK(id_accept_rejected());
+	CHECK(!id_accept_commit());
+
+	//8 ranges x 64 IDs: more than the set takes, refused instead of overfilled
+	id_accept_clear();
+	uint8_t ok = 1;
+	for (uint8_t r = 0; r < 8; r++)
+		ok &= id_accept_add(0x10000000 | (r << 16), 0x1FFFFFC0, 1);
+	CHECK(!ok);
+	CHECK(id_accept_rejected());
+	CHECK(!id_accept_commit());
+
+	//wide ranges go to the range list, 8 of them
+	id_accept_clear();
+	for (uint8_t r = 0; r < ID_ACCEPT_EXT_RANGES; r++)
+		CHECK(id_accept_add(r << 20, 0x1FF00000, 1));
+	CHECK(!id_accept_add(0x1F000000, 0x1FF00000, 1));
+	CHECK(id_accept_rejected() == 1);
+
+	printf("test_id_accept: %u failures\n", fails);
+	return fails?1:0;
+}
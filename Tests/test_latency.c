@@ -0,0 +1,85 @@
+/*
+ * test_latency.c
+ *
+ *  Created on: 19 окт. 2026 г.
+ *      Author: Rem Norton
+ */
+#include "latency.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SAMPLES		100000
+
+static uint32_t samples[SAMPLES];
+static uint32_t fails = 0;
+
+//
+//Private forwards
+//
+static int cmp(const void* a, const void* b);
+static void check(const char* name, uint16_t permille);
+
+//
+//The status p99 figures come from the log histogram: the reported value
+//must be the true percentile or at most one sub-bucket (25%) above it.
+//
+int main()
+{
+	static const uint16_t permille[] = {500, 990, 1000};
+	srand(40);
+
+	for (uint8_t p = 0; p < sizeof(permille)/sizeof(permille[0]); p++)
+	{
+		//USB polling: 1 ms frames, a few us of jitter
+		for (uint32_t i = 0; i < SAMPLES; i++)
+			samples[i] = rand() % 1000 + rand() % 8;
+		check("uniform 0..1 ms", permille[p]);
+
+		//mostly short, a tail of blocked transfers
+		for (uint32_t i = 0; i < SAMPLES; i++)
+			samples[i] = (rand() % 100)?(20 + rand() % 200):(5000 + rand() % 20000);
+		check("short + 1% tail", permille[p]);
+
+		//spread over the whole range, top bucket included
+		for (uint32_t i = 0; i < SAMPLES; i++)
+			samples[i] = rand() >> (rand() % 31);
+		check("log spread", permille[p]);
+	}
+
+	printf("test_latency: %u failures\n", fails);
+	return fails?1:0;
+}
+
+//
+//Private members
+//
+static int cmp(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+static void check(const char* name, uint16_t permille)
+{
+	Latency_t lat;
+	latency_reset(&lat);
+	for (uint32_t i = 0; i < SAMPLES; i++)
+		latency_add(&lat, samples[i]);
+
+	qsort(samples, SAMPLES, sizeof(uint32_t), cmp);
+	uint32_t rank = ((uint64_t)SAMPLES*permille + 999)/1000;
+	uint32_t exact = samples[rank - 1];
+	uint32_t got = latency_percentile(&lat, permille);
+
+	//above 2^LATENCY_MAX_BIT everything is in the top bucket, only max is exact
+	uint8_t ok = (got >= exact) && ((exact >= (1U << LATENCY_MAX_BIT)) || (got <= exact + exact/4 + 1));
+	if (exact >= (1U << LATENCY_MAX_BIT)) ok = (got == lat.max);
+	if (!ok)
+	{
+		printf("%s p%u: %u, exact %u\n", name, permille/10, got, exact);
+		fails++;
+	}
+	else
+		printf("%-16s p%-4.1f exact %7u  reported %7u\n", name, permille/10.0, exact, got);
+}
@@ -0,0 +1,53 @@
+/*
+ * test_mess_pck.c
+ *
+ *  Created on: 19 окт. 2026 г.
+ *      Author: Rem Norton
+ */
+#include "proto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAMES		10000
+
+//
+//A ring slot with its header set once (app_init) and the frame written by
+//the RX ISR must be byte for byte what make_usb_can_pck() used to build,
+//so the slot can go to USB as is. Also prints the bytes copied per frame.
+//
+int main()
+{
+	uint32_t fails = 0;
+	CAN_USB_MessPck_t slot;
+	slot.hdr.prefix = _PREFIX_;
+	slot.hdr.type = CAN_PT_MESS;
+	slot.hdr.datalen = sizeof(CAN_USB_Mess_t);
+
+	srand(43);
+	for (uint32_t i = 0; i < FRAMES; i++)
+	{
+		CAN_USB_Mess_t mess;
+		memset(&mess, 0, sizeof(mess));
+		mess.flags.ide = rand() & 1;
+		mess.flags.rtr = (rand() & 7) == 0;
+		mess.flags.dlc = rand() % 9;
+		mess.id = (((uint32_t)rand() << 8) ^ rand()) & (mess.flags.ide?0x1FFFFFFF:0x7FF);
+		mess.filter = rand();
+		for (uint8_t b = 0; b < mess.flags.dlc; b++)
+			mess.data[b] = rand();
+
+		uint8_t out[sizeof(CAN_USB_Header_t) + sizeof(CAN_USB_Mess_t)];
+		uint8_t len = make_usb_can_pck(CAN_PT_MESS, &mess, sizeof(mess), out);
+
+		slot.mess = mess;
+		if ((len != sizeof(slot)) || memcmp(out, &slot, sizeof(slot)))
+			fails++;
+	}
+
+	printf("bytes written per plain RX frame: before %u (ISR) + %u (make_usb_can_pck) = %u, after %u (ISR)\n",
+			(unsigned)sizeof(CAN_USB_Mess_t), (unsigned)sizeof(CAN_USB_MessPck_t), (unsigned)(sizeof(CAN_USB_Mess_t) + sizeof(CAN_USB_MessPck_t)),
+			(unsigned)sizeof(CAN_USB_Mess_t));
+	printf("test_mess_pck: %u mismatches\n", fails);
+	return fails?1:0;
+}
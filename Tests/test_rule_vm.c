@@ -0,0 +1,216 @@
+/*
+ * test_rule_vm.c
+ *
+ *  Created on: 19 окт. 2026 г.
+ *      Author: Rem Norton
+ */
+
+//the interpreter is included to reach its program image and budget,
+//the runtime guards only trip on a corrupted image
+#include "../App/rule_vm.c"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(c)	do { if (!(c)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #c); fails++; } } while (0)
+
+static uint32_t fails = 0;
+static Insn_t prog[INSN_MAX];
+static uint16_t prog_len = 0;
+static CAN_USB_Mess_t emitted[8];
+static uint8_t emitted_count = 0;
+static uint8_t emit_refuse = 0;
+
+//
+//Private forwards
+//
+static uint8_t emit(const CAN_USB_Mess_t* mess);
+static void put(uint8_t op, uint8_t a, uint8_t b, uint8_t c);
+static uint8_t verify(uint16_t* worst, uint16_t* pc);
+static uint8_t start(uint16_t budget);
+static CAN_USB_Mess_t frame(uint32_t id, uint64_t data);
+static uint64_t data_of(const CAN_USB_Mess_t* mess);
+
+int main()
+{
+	uint16_t worst, pc;
+	rule_vm_init(emit);
+
+	//worst path is the longer arm of a branch: 2 + max(1, 4) + 1
+	prog_len = 0;
+	put(CAN_VMI_LDI, 0, 1, 0);
+	put(CAN_VMI_JEQ, 0, 1, 1);
+	put(CAN_VMI_JMP, 0, 0, 3);
+	put(CAN_VMI_ADDI, 0, 1, 0);
+	put(CAN_VMI_ADDI, 0, 1, 0);
+	put(CAN_VMI_ADDI, 0, 1, 0);
+	put(CAN_VMI_END, 0, 0, 0);
+	CHECK(verify(&worst, &pc) == CAN_VME_OK);
+	CHECK(worst == 6);
+	CHECK(!start(worst - 1));
+	CAN_USB_VmStat_t st;
+	rule_vm_stat(&st);
+	CHECK(st.error == CAN_VME_BUDGET);
+	CHECK(start(worst));
+
+	//longest possible program: every instruction on one path
+	prog_len = 0;
+	while (prog_len < INSN_MAX)
+		put(CAN_VMI_ADDI, 0, 1, 0);
+	CHECK(verify(&worst, &pc) == CAN_VME_OK);
+	CHECK(worst == INSN_MAX);
+	CHECK(start(0));
+
+	//emit limit counts sends on one path, exclusive arms don't add up
+	prog_len = 0;
+	for (uint8_t i = 0; i <= RULE_VM_EMIT_MAX; i++)
+		put(CAN_VMI_SEND, 0, 0, 0);
+	CHECK(verify(&worst, &pc) == CAN_VME_EMIT);
+	CHECK(pc == 0);
+	CHECK(!start(0));
+
+	prog_len = 0;
+	put(CAN_VMI_JEQ, 0, 1, RULE_VM_EMIT_MAX);
+	for (uint8_t i = 0; i < RULE_VM_EMIT_MAX; i++)
+		put(CAN_VMI_SEND, 0, 0, 0);
+	for (uint8_t i = 0; i < RULE_VM_EMIT_MAX; i++)
+		put(CAN_VMI_SEND, 0, 0, 0);
+	CHECK(verify(&worst, &pc) == CAN_VME_EMIT);
+	prog[1 + RULE_VM_EMIT_MAX - 1].op = CAN_VMI_END;
+	CHECK(verify(&worst, &pc) == CAN_VME_OK);
+
+	//operand checks, GETB/PUTB bounds: c 1..32, b + c <= 64
+	prog_len = 0;
+	put(CAN_VMI_JMP, 0, 0, 1);
+	CHECK(verify(&worst, &pc) == CAN_VME_JUMP);
+	prog_len = 0;
+	put(CAN_VMI_MOV, 0, RULE_VM_REGS, 0);
+	CHECK(verify(&worst, &pc) == CAN_VME_OPERAND);
+	prog_len = 0;
+	put(0xEE, 0, 0, 0);
+	CHECK(verify(&worst, &pc) == CAN_VME_OPCODE);
+	CHECK(rule_vm_verify((const uint8_t*)prog, 3, &worst, &pc) == CAN_VME_SIZE);
+
+	static const struct { uint8_t b, c, ok; } bits[] =
+	{
+		{32, 32, 1}, {0, 32, 1}, {63, 1, 1}, {56, 8, 1},
+		{33, 32, 0}, {64, 1, 0}, {0, 33, 0}, {0, 0, 0}
+	};
+	for (uint8_t k = 0; k < sizeof(bits)/sizeof(bits[0]); k++)
+	{
+		for (uint8_t op = CAN_VMI_GETB; op <= CAN_VMI_PUTB; op += CAN_VMI_PUTB - CAN_VMI_GETB)
+		{
+			prog_len = 0;
+			put(op, 0, bits[k].b, bits[k].c);
+			CHECK((verify(&worst, &pc) == CAN_VME_OK) == bits[k].ok);
+		}
+	}
+
+	//halves swapped with 32 bit fields, then bit 63 copied alone; the result
+	//goes out under id + 1 through the emit callback
+	prog_len = 0;
+	put(CAN_VMI_OUT, 0, 0, 0);
+	put(CAN_VMI_GETB, 0, 32, 32);
+	put(CAN_VMI_GETB, 1, 0, 32);
+	put(CAN_VMI_PUTB, 0, 0, 32);
+	put(CAN_VMI_PUTB, 1, 32, 32);
+	put(CAN_VMI_GETB, 2, 63, 1);
+	put(CAN_VMI_PUTB, 2, 63, 1);
+	put(CAN_VMI_ID, 3, 0, 0);
+	put(CAN_VMI_ADDI, 3, 1, 0);
+	put(CAN_VMI_OID, 3, 0, 0);
+	put(CAN_VMI_SEND, 0, 0, 0);
+	put(CAN_VMI_END, 0, 0, 0);
+	CHECK(start(0));
+
+	srand(48);
+	for (uint16_t n = 0; n < 1000; n++)
+	{
+		uint64_t d = ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ rand();
+		CAN_USB_Mess_t in = frame(0x100, d);
+		emitted_count = 0;
+		rule_vm_pass(&in);
+		CHECK(emitted_count == 1);
+
+		uint64_t swapped = (d >> 32) | (d << 32);
+		swapped = (swapped & ~(1ULL << 63)) | (d & (1ULL << 63));
+		CHECK(emitted[0].id == 0x101);
+		CHECK(emitted[0].flags.dlc == 8);
+		CHECK(data_of(&emitted[0]) == swapped);
+	}
+	rule_vm_stat(&st);
+	CHECK((st.runs == 1000) && (st.sent == 1000) && !st.busy && !st.aborted);
+
+	//a refused send is counted, echoed frames never run
+	emit_refuse = 1;
+	CAN_USB_Mess_t in = frame(0x100, 0);
+	rule_vm_pass(&in);
+	emit_refuse = 0;
+	in.flags.echo = 1;
+	rule_vm_pass(&in);
+	rule_vm_stat(&st);
+	CHECK((st.runs == 1001) && (st.busy == 1));
+
+	//runtime guards: a budget below the proven worst case and a bad opcode
+	in.flags.echo = 0;
+	emitted_count = 0;
+	budget = 3;
+	rule_vm_pass(&in);
+	rule_vm_stat(&st);
+	CHECK((st.aborted == 1) && !emitted_count);
+	budget = RULE_VM_BUDGET_MAX;
+	code[1].op = 0xEE;
+	rule_vm_pass(&in);
+	rule_vm_stat(&st);
+	CHECK((st.aborted == 2) && !emitted_count);
+
+	printf("test_rule_vm: %u failures\n", fails);
+	return fails?1:0;
+}
+
+//
+//Private members
+//
+static uint8_t emit(const CAN_USB_Mess_t* mess)
+{
+	if (emit_refuse) return 0;
+	if (emitted_count < sizeof(emitted)/sizeof(emitted[0]))
+		emitted[emitted_count++] = *mess;
+	return 1;
+}
+
+static void put(uint8_t op, uint8_t a, uint8_t b, uint8_t c)
+{
+	prog[prog_len++] = (Insn_t){op, a, b, c};
+}
+
+static uint8_t verify(uint16_t* worst, uint16_t* pc)
+{
+	return rule_vm_verify((const uint8_t*)prog, prog_len*sizeof(Insn_t), worst, pc);
+}
+
+static uint8_t start(uint16_t budget)
+{
+	CAN_USB_VmStart_t st;
+	memset(&st, 0, sizeof(st));
+	st.size = prog_len*sizeof(Insn_t);
+	st.budget = budget;
+	rule_vm_load(0, (const uint8_t*)prog, st.size);
+	return rule_vm_start(&st);
+}
+
+static CAN_USB_Mess_t frame(uint32_t id, uint64_t data)
+{
+	CAN_USB_Mess_t m;
+	memset(&m, 0, sizeof(m));
+	m.id = id;
+	m.flags.dlc = 8;
+	memcpy(m.data, &data, sizeof(data));
+	return m;
+}
+
+static uint64_t data_of(const CAN_USB_Mess_t* mess)
+{
+	uint64_t v;
+	memcpy(&v, mess->data, sizeof(v));
+	return v;
+}
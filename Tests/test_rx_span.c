@@ -0,0 +1,157 @@
+/*
+ * test_rx_span.c
+ *
+ *  Created on: 19 окт. 2026 г.
+ *      Author: Rem Norton
+ */
+#include "rx_span.h"
+#include "rx_congest.h"
+#include <stdio.h>
+#include <string.h>
+
+#define RING_SIZE	16
+
+static CAN_USB_MessPck_t ring[RING_SIZE];
+static Rx_Span_t span;
+static uint32_t fails = 0;
+
+//
+//Private forwards
+//
+static void reset(uint8_t conflate);
+static uint16_t isr(uint32_t id);
+static uint16_t packed_pass(uint8_t busy, uint32_t* ids, uint16_t max);
+static uint16_t plain_pass(uint8_t busy, uint16_t max);
+static void expect(const char* name, uint32_t got, uint32_t want);
+
+//
+//Drives the ring the way can_rx_fifo0() and handle_can_rx() do: a frame
+//is read exactly once whatever the mode and the USB state, and congestion
+//never overwrites a slot that is lent to USB or already read.
+//
+int main()
+{
+	uint32_t ids[RING_SIZE];
+
+	//two packed passes, the second one while USB is still busy
+	reset(0);
+	for (uint32_t i = 0; i < 5; i++) isr(i);
+	expect("packed first pass", packed_pass(0, ids, RING_SIZE), 5);
+	for (uint32_t i = 5; i < 8; i++) isr(i);
+	uint16_t n = packed_pass(1, ids, RING_SIZE);
+	expect("packed second pass, USB busy", n, 3);
+	expect("packed second pass, first id", ids[0], 5);
+	n = packed_pass(0, ids, RING_SIZE);
+	expect("packed third pass, nothing new", n, 0);
+
+	//plain span held until USB is done, then released
+	reset(0);
+	for (uint32_t i = 0; i < 4; i++) isr(i);
+	expect("plain lend", plain_pass(0, RING_SIZE), 4);
+	for (uint32_t i = 4; i < 6; i++) isr(i);
+	expect("plain, USB busy", plain_pass(1, RING_SIZE), 0);
+	expect("plain, tail held", span.tail, 0);
+	expect("plain after release", plain_pass(0, RING_SIZE), 2);
+	expect("plain, tail released", span.tail, 4);
+
+	//the in place span stops at the end of the ring
+	reset(0);
+	for (uint32_t i = 0; i < RING_SIZE - 1; i++) isr(i);
+	packed_pass(0, ids, 12);
+	for (uint32_t i = 0; i < 8; i++) isr(i);
+	expect("plain span to ring end", plain_pass(0, RING_SIZE), RING_SIZE - 12);
+	expect("plain span from ring start", plain_pass(0, RING_SIZE), 7);
+
+	//plain to packed with a span still lent
+	reset(0);
+	for (uint32_t i = 0; i < 6; i++) isr(i);
+	plain_pass(0, 3);
+	expect("packed after plain, USB busy", packed_pass(1, ids, RING_SIZE), 0);
+	n = packed_pass(0, ids, RING_SIZE);
+	expect("packed after plain", n, 3);
+	expect("packed after plain, first id", ids[0], 3);
+
+	//conflation skips read frames and the lent span, fill counts both
+	reset(1);
+	isr(0x100);
+	packed_pass(0, ids, RING_SIZE);
+	expect("conflate after packed read", isr(0x100), RX_CONGEST_KEEP);
+	isr(0x200);
+	expect("conflate pending", isr(0x200), 2);
+	plain_pass(0, RING_SIZE);
+	isr(0x300);
+	expect("conflate lent span", isr(0x200), RX_CONGEST_KEEP);
+	CAN_USB_CongestionStat_t stat;
+	rx_congest_stat(&stat);
+	expect("fill with a lent span", stat.fill, 3);
+
+	printf("test_rx_span: %u failures\n", fails);
+	return fails?1:0;
+}
+
+//
+//Private members
+//
+static void reset(uint8_t conflate)
+{
+	memset(ring, 0, sizeof(ring));
+	rx_span_init(&span, RING_SIZE);
+	rx_congest_init(ring, RING_SIZE);
+
+	CAN_USB_Congestion_t cfg;
+	cfg.flags = conflate?CAN_CONG_CONFLATE:0;
+	cfg.high = cfg.low = 0;
+	cfg.prio_id = 0x7FF;
+	rx_congest_set(&cfg);
+}
+
+//can_rx_fifo0(): returns the congestion verdict
+static uint16_t isr(uint32_t id)
+{
+	CAN_USB_Mess_t scratch;
+	uint16_t head = span.head;
+	uint16_t next = (head + 1) & (RING_SIZE - 1);
+	CAN_USB_Mess_t* mess = (next != span.tail)?&ring[head].mess:&scratch;
+	memset(mess, 0, sizeof(*mess));
+	mess->id = id;
+
+	uint16_t slot = rx_congest_pass(mess, head, span.tail, span.sent);
+	if (slot != RX_CONGEST_KEEP)
+	{
+		if (slot != RX_CONGEST_DROP) ring[slot].mess = *mess;
+		return slot;
+	}
+	if (mess != &scratch) span.head = next;
+	return slot;
+}
+
+//handle_can_rx() with packed records: frames are copied out
+static uint16_t packed_pass(uint8_t busy, uint32_t* ids, uint16_t max)
+{
+	if (!rx_span_release(&span, busy)) return 0;
+
+	uint16_t head = span.head;
+	uint16_t n = 0;
+	while ((span.tail != head) && (n < max))
+		ids[n++] = ring[rx_span_take(&span)].mess.id;
+	return n;
+}
+
+//handle_can_rx() with plain frames: the span is read in place
+static uint16_t plain_pass(uint8_t busy, uint16_t max)
+{
+	if (!rx_span_release(&span, busy)) return 0;
+
+	uint16_t head = span.head;
+	if (span.tail == head) return 0;
+	uint16_t n = rx_span_avail(&span, head, max);
+	rx_span_lend(&span, n);
+	return n;
+}
+
+static void expect(const char* name, uint32_t got, uint32_t want)
+{
+	if (got == want) return;
+	printf("%s: %u, expected %u\n", name, got, want);
+	fails++;
+}